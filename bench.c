@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "figtree.h"
+#include "interval.h"
+
+/* Microbenchmarks for the Fig Tree. For each tree size from 1e3 up to the
+ * size given on the command line (1e6 by default), each operation is timed
+ * individually for its latency percentiles, and then run again untimed for
+ * its throughput. The results are printed as JSON.
+ *
+ * Trees of N FIGs hold [4i, 4i + 2] -> i for i in [0, N), so the byte 4i + 3
+ * is never mapped.
+ */
+
+#define MAX_OPS 100000
+#define SHORT_SCAN_FIGS 10
+#define LONG_SCAN_FIGS 1000
+#define FULL_SCAN_OPS 20 // scans of the whole tree are only timed this often
+
+typedef void (*benchfn_t)(struct figtree* tree, uint64_t figs, size_t i);
+
+struct benchop {
+    const char* name;
+    benchfn_t fn;
+    bool fresh; // whether the op modifies the tree, so it needs its own
+    size_t max_ops; // limit on the number of ops timed, if not 0
+};
+
+static uint64_t* randoms;
+static bool first_result = true;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t splitmix(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void load_tree(struct figtree* tree, uint64_t figs) {
+    struct fig* all = malloc(figs * sizeof(struct fig));
+    uint64_t i;
+    for (i = 0; i < figs; i++) {
+        i_init(&all[i].irange, (byte_index_t) (i << 2),
+               (byte_index_t) ((i << 2) + 2));
+        all[i].value = (figtree_value_t) i;
+    }
+    ft_load(tree, all, figs);
+    free(all);
+}
+
+static void op_write_random(struct figtree* tree, uint64_t figs, size_t i) {
+    byte_index_t start = (byte_index_t) ((randoms[i] % figs) << 2);
+    ft_write(tree, start, start + (byte_index_t) (randoms[i] >> 60),
+             (figtree_value_t) i);
+}
+
+static void op_write_sequential(struct figtree* tree, uint64_t figs,
+                                size_t i) {
+    byte_index_t start = (byte_index_t) ((i % figs) << 2);
+    ft_write(tree, start, start + 1, (figtree_value_t) i);
+}
+
+static void op_write_append(struct figtree* tree, uint64_t figs, size_t i) {
+    byte_index_t start = (byte_index_t) ((figs + i) << 2);
+    ft_write(tree, start, start + 2, (figtree_value_t) i);
+}
+
+static void op_lookup_hit(struct figtree* tree, uint64_t figs, size_t i) {
+    byte_index_t location = (byte_index_t) (((randoms[i] % figs) << 2) + 1);
+    if (ft_lookup(tree, location) == NULL) {
+        fprintf(stderr, "lookup_hit missed\n");
+        exit(1);
+    }
+}
+
+static void op_lookup_miss(struct figtree* tree, uint64_t figs, size_t i) {
+    byte_index_t location = (byte_index_t) (((randoms[i] % figs) << 2) + 3);
+    if (ft_lookup(tree, location) != NULL) {
+        fprintf(stderr, "lookup_miss hit\n");
+        exit(1);
+    }
+}
+
+static bool count_fig(struct fig* fig, void* arg) {
+    (void) fig;
+    (*(uint64_t*) arg)++;
+    return true;
+}
+
+/* Reads LENGTH FIGs from a random position, with an iterator or, if VISIT,
+ * with ft_foreach. */
+static void scan(struct figtree* tree, uint64_t figs, size_t i,
+                 uint64_t length, bool visit) {
+    uint64_t first = length >= figs ? 0 : randoms[i] % (figs - length);
+    byte_index_t start = (byte_index_t) (first << 2);
+    byte_index_t end = (byte_index_t) (((first + length) << 2) - 1);
+    struct figtree_iter* iter;
+    struct fig fig;
+    uint64_t count = 0;
+
+    if (visit) {
+        ft_foreach(tree, start, end, count_fig, &count);
+    } else {
+        iter = ft_read(tree, start, end);
+        while (fti_next(iter, &fig)) {
+            count++;
+        }
+        fti_free(iter);
+    }
+    if (count != (length < figs ? length : figs)) {
+        fprintf(stderr, "scan found %lu FIGs\n", (unsigned long) count);
+        exit(1);
+    }
+}
+
+static void op_read_short(struct figtree* tree, uint64_t figs, size_t i) {
+    scan(tree, figs, i, SHORT_SCAN_FIGS, false);
+}
+
+static void op_read_long(struct figtree* tree, uint64_t figs, size_t i) {
+    scan(tree, figs, i, LONG_SCAN_FIGS, false);
+}
+
+static void op_foreach_long(struct figtree* tree, uint64_t figs, size_t i) {
+    scan(tree, figs, i, LONG_SCAN_FIGS, true);
+}
+
+static void op_read_full(struct figtree* tree, uint64_t figs, size_t i) {
+    scan(tree, figs, i, figs, false);
+}
+
+static void op_foreach_full(struct figtree* tree, uint64_t figs, size_t i) {
+    scan(tree, figs, i, figs, true);
+}
+
+static void op_iter_create(struct figtree* tree, uint64_t figs, size_t i) {
+    static _Alignas(8) char storage[4096];
+    byte_index_t start = (byte_index_t) ((randoms[i] % figs) << 2);
+    ft_read_init(tree, storage, sizeof(storage), start, BYTE_INDEX_MAX);
+}
+
+static const struct benchop ops[] = {
+    { "write_random", op_write_random, true, 0 },
+    { "write_sequential", op_write_sequential, true, 0 },
+    { "write_append", op_write_append, true, 0 },
+    { "lookup_hit", op_lookup_hit, false, 0 },
+    { "lookup_miss", op_lookup_miss, false, 0 },
+    { "read_short", op_read_short, false, 0 },
+    { "read_long", op_read_long, false, 0 },
+    { "foreach_long", op_foreach_long, false, 0 },
+    { "read_full", op_read_full, false, FULL_SCAN_OPS },
+    { "foreach_full", op_foreach_full, false, FULL_SCAN_OPS },
+    { "iter_create", op_iter_create, false, 0 },
+};
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char* name, uint64_t figs, size_t numops,
+                   uint64_t elapsed, uint64_t* samples) {
+    qsort(samples, numops, sizeof(uint64_t), compare_u64);
+    printf("%s\n    {\"op\": \"%s\", \"figs\": %lu, \"ops\": %lu, "
+           "\"ops_per_sec\": %.0f, \"p50_ns\": %lu, \"p99_ns\": %lu, "
+           "\"p999_ns\": %lu}", first_result ? "" : ",", name,
+           (unsigned long) figs, (unsigned long) numops,
+           (double) numops * 1e9 / (double) (elapsed == 0 ? 1 : elapsed),
+           (unsigned long) samples[numops / 2],
+           (unsigned long) samples[numops * 99 / 100],
+           (unsigned long) samples[numops * 999 / 1000]);
+    first_result = false;
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    uint64_t maxfigs = 1000000;
+    uint64_t figs, seed = 1;
+    uint64_t* samples = malloc(MAX_OPS * sizeof(uint64_t));
+    struct figtree tree;
+    size_t k, i;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [max FIGs, up to 1e9]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        maxfigs = (uint64_t) strtod(argv[1], NULL);
+    }
+    if (maxfigs > (BYTE_INDEX_MAX >> 2) - MAX_OPS) {
+        fprintf(stderr, "At most %lu FIGs fit in the byte index\n",
+                (unsigned long) ((BYTE_INDEX_MAX >> 2) - MAX_OPS));
+        return 1;
+    }
+
+    randoms = malloc(MAX_OPS * sizeof(uint64_t));
+    for (i = 0; i < MAX_OPS; i++) {
+        randoms[i] = splitmix(&seed);
+    }
+
+    printf("{\"benchmarks\": [");
+    for (figs = 1000; figs <= maxfigs; figs *= 10) {
+        load_tree(&tree, figs);
+        for (k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+            size_t numops = figs < MAX_OPS ? (size_t) figs : MAX_OPS;
+            uint64_t begin, start, end;
+            if (ops[k].max_ops != 0 && numops > ops[k].max_ops) {
+                numops = ops[k].max_ops;
+            }
+            if (ops[k].fresh) {
+                ft_dealloc(&tree);
+                load_tree(&tree, figs);
+            }
+            for (i = 0; i < numops; i++) {
+                start = now_ns();
+                ops[k].fn(&tree, figs, i);
+                end = now_ns();
+                samples[i] = end - start;
+            }
+
+            /* The throughput comes from a second pass over the same ops,
+             * since the clock reads around each op would count against it. */
+            if (ops[k].fresh) {
+                ft_dealloc(&tree);
+                load_tree(&tree, figs);
+            }
+            begin = now_ns();
+            for (i = 0; i < numops; i++) {
+                ops[k].fn(&tree, figs, i);
+            }
+            report(ops[k].name, figs, numops, now_ns() - begin, samples);
+        }
+        ft_dealloc(&tree);
+    }
+    printf("\n]}\n");
+
+    free(randoms);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#define FT_TYPED_NAME doubletree
+#define FT_TYPED_VALUE double
+#define FT_TYPED_ORDER 3
+
+#include "typedtrees.h"
+#include "figtreetyped.c"
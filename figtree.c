@@ -1,16 +1,84 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "figtree.h"
+#include "figtreebuf.h"
+#include "figtreeindex.h"
 #include "figtreenode.h"
+#include "figtreeprof.h"
+#include "figtreetrace.h"
 #include "interval.h"
 #include "utils.h"
 
 /* Fig Tree */
 
+/* The source of generations for all trees. A generation is only taken when
+ * a tree is initialized or loaded, and is never reused, so a cached FIG can
+ * never match a later tree at the same address.
+ */
+static uint64_t ft_generations = 0;
+
+/* Starts the tree on a new generation. */
+void _ft_new_generation(struct figtree* this) {
+    this->generation = __atomic_add_fetch(&ft_generations, 1,
+                                          __ATOMIC_RELAXED);
+    this->epoch = 0;
+}
+
+/* Marks the tree as modified, which invalidates every FIG cached from it. */
+void _ft_modified(struct figtree* this) {
+    this->epoch++;
+}
+
+/* Returns the child of NODE at INDEX, unpacked so that it can be modified
+ * (see ftn_child). Unpacking moves the values of a compressed leaf, so it
+ * invalidates cached FIGs even if the write that needed it does not happen.
+ */
+struct ft_node* _ft_child(struct figtree* this, struct ft_node* node,
+                          int index) {
+    struct ft_node* child = subtree_get(&node->subtrees[index]);
+    if (child != NULL && child->compressed) {
+        _ft_modified(this);
+        child = ftn_child(node, index);
+    }
+    return child;
+}
+
+/* A FIG that a lookup on TREE resolved while it was at GENERATION and EPOCH,
+ * and a pointer to its value, which stays valid until the tree is modified.
+ */
+struct ft_cachedfig {
+    struct figtree* tree;
+    uint64_t generation;
+    uint64_t epoch;
+    struct interval range;
+    figtree_value_t* value;
+};
+
+#define FT_LOOKUP_CACHE_SLOTS 8
+
+/* One thread's lookup cache (see ft_set_lookup_cache). Slots are replaced
+ * round-robin. HITS and MISSES count the thread's cached lookups on all trees.
+ */
+struct ft_lookupcache {
+    struct ft_cachedfig slots[FT_LOOKUP_CACHE_SLOTS];
+    unsigned next;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static __thread struct ft_lookupcache ft_lookupcache_local;
+
 void ft_init(struct figtree* this) {
-    this->root = ftn_new(0, true);
+    ftn_init(&this->root, 0, true);
+    this->valueindex = NULL;
+    this->buffer = NULL;
+    this->buffer_limit = 0;
+    this->trace = NULL;
+    this->lookup_cache = false;
+    _ft_new_generation(this);
 }
 
 struct insertargs {
@@ -18,8 +86,144 @@ struct insertargs {
     figtree_value_t value;
     struct ft_node* at;
     struct interval valid;
+    figfn_t shadowfn; // if not NULL, called on each FIG this write shadows
+    void* shadowarg;
+    struct writecond* cond; // if not NULL, the write only happens if it holds
 };
 
+/* Returns the absolute range of entry I of NODE, given BASE, the sum of the
+ * offsets of NODE and its ancestors. If the stored range has to be moved, the
+ * result is put in SCRATCH.
+ */
+struct interval* _ft_range(struct ft_node* node, int i, int64_t base,
+                           struct interval* scratch) {
+    if (base == 0) {
+        return &node->entries[i].irange;
+    }
+    scratch->left = node->entries[i].irange.left + (byte_index_t) base;
+    scratch->right = node->entries[i].irange.right + (byte_index_t) base;
+    scratch->nonempty = true;
+    return scratch;
+}
+
+/* Calls FN, in order, on each live FIG in the subtree rooted at NODE that
+ * overlaps RANGE, clipped to RANGE. VALID is the valid interval of NODE;
+ * entries outside of it have been shadowed by entries higher up the tree.
+ * BASE is the sum of the offsets of the ancestors of NODE.
+ */
+void _ft_walk(struct ft_node* node, int64_t base, struct interval* valid,
+              struct interval* range, figfn_t fn, void* arg) {
+    struct ft_node leaf;
+    struct interval window;
+    struct interval gap;
+    struct interval scratch;
+    struct fig fig;
+    byte_index_t gapleft = BYTE_INDEX_MIN;
+    bool gapempty = false;
+    int i;
+
+    memcpy(&window, valid, sizeof(struct interval));
+    i_restrict_int(&window, range, true);
+    if (node != NULL) {
+        node = ftn_view(node, &leaf);
+        base += node->offset;
+    }
+
+    for (i = 0; window.nonempty && node != NULL && i <= node->entries_len;
+         i++) {
+        struct interval* currival = i == node->entries_len ? NULL :
+            _ft_range(node, i, base, &scratch);
+
+        /* Visit the subtree to the left of the current entry. */
+        if (currival == NULL || currival->left > gapleft) {
+            i_init(&gap, gapleft, currival == NULL ? BYTE_INDEX_MAX :
+                   currival->left - 1);
+            if (!gapempty && i_overlaps(&gap, &window)) {
+                i_restrict_int(&gap, &window, false);
+                _ft_walk(subtree_get(&node->subtrees[i]), base, &gap, &window,
+                         fn, arg);
+            }
+        }
+
+        if (currival == NULL || i_rightOf_int(currival, &window)) {
+            break;
+        }
+
+        if (i_overlaps(currival, &window)) {
+            memcpy(&fig.irange, currival, sizeof(struct interval));
+            i_restrict_int(&fig.irange, &window, false);
+            fig.value = node->entries[i].value;
+            fn(&fig, arg);
+        }
+
+        gapempty = (currival->right == BYTE_INDEX_MAX);
+        gapleft = currival->right + 1;
+    }
+}
+
+/* Calls FN, in order, on each FIG in the subtree rooted at NODE that overlaps
+ * [LEFT, RIGHT], clipped to it, until FN returns false. Unlike _ft_walk, this
+ * relies on writes having pruned every entry to its node's valid interval, so
+ * it needs no valid intervals, only the bounds of the scan. LEFT and RIGHT
+ * are relative to BASE, the sum of the offsets of the ancestors of NODE, and
+ * may lie outside of the byte indices. Returns false if FN stopped the
+ * traversal.
+ */
+bool _ft_visit(struct ft_node* node, int64_t base, int64_t left,
+               int64_t right, figvisitfn_t fn, void* arg) {
+    struct ft_node leaf;
+    struct ft_node* subtree;
+    struct ft_ent* entry;
+    struct fig fig;
+    int i;
+
+    /* Move the bounds into the coordinates that NODE stores its entries in,
+     * rather than moving every entry.
+     */
+    left -= node->offset;
+    right -= node->offset;
+    base += node->offset;
+    if (right < BYTE_INDEX_MIN || left > BYTE_INDEX_MAX) {
+        return true;
+    }
+    node = ftn_view(node, &leaf);
+
+    fig.irange.nonempty = true;
+    for (i = 0; i < node->entries_len; i++) {
+        entry = &node->entries[i];
+        if (entry->irange.right < left) {
+            continue;
+        }
+
+        /* The subtree to the left of ENTRY lies between it and the previous
+         * entry, which ended before LEFT.
+         */
+        subtree = subtree_get(&node->subtrees[i]);
+        if (subtree != NULL && entry->irange.left > left &&
+            !_ft_visit(subtree, base, left, right, fn, arg)) {
+            return false;
+        }
+
+        if (entry->irange.left > right) {
+            return true;
+        }
+        fig.irange.left = (byte_index_t) (MAX(entry->irange.left, left) +
+                                          base);
+        fig.irange.right = (byte_index_t) (MIN(entry->irange.right, right) +
+                                           base);
+        fig.value = entry->value;
+        if (!fn(&fig, arg)) {
+            return false;
+        }
+        if (entry->irange.right >= right) {
+            return true;
+        }
+    }
+
+    subtree = subtree_get(&node->subtrees[i]);
+    return subtree == NULL || _ft_visit(subtree, base, left, right, fn, arg);
+}
+
 struct insertcont {
     bool hasleftc;
     struct insertargs leftc;
@@ -27,6 +231,119 @@ struct insertcont {
     struct insertargs rightc;
 };
 
+/* Tracks a differing range that has not been reported yet, so that adjacent
+ * pieces with the same pair of values are reported as one range.
+ */
+struct pendingdiff {
+    bool valid;
+    struct interval range;
+    bool hasold;
+    figtree_value_t oldval;
+    bool hasnew;
+    figtree_value_t newval;
+};
+
+void _pendingdiff_flush(struct pendingdiff* this, figdifffn_t fn, void* arg) {
+    if (this->valid) {
+        fn(&this->range, this->hasold ? &this->oldval : NULL,
+           this->hasnew ? &this->newval : NULL, arg);
+        this->valid = false;
+    }
+}
+
+void _pendingdiff_add(struct pendingdiff* this, byte_index_t left,
+                      byte_index_t right, struct fig* oldfig,
+                      struct fig* newfig, figdifffn_t fn, void* arg) {
+    if (this->valid && this->range.right + 1 == left &&
+        this->hasold == (oldfig != NULL) && this->hasnew == (newfig != NULL) &&
+        (oldfig == NULL || FT_VALUE_EQUAL(this->oldval, oldfig->value)) &&
+        (newfig == NULL || FT_VALUE_EQUAL(this->newval, newfig->value))) {
+        this->range.right = right;
+        return;
+    }
+    _pendingdiff_flush(this, fn, arg);
+    this->valid = true;
+    i_init(&this->range, left, right);
+    this->hasold = (oldfig != NULL);
+    if (oldfig != NULL) {
+        this->oldval = oldfig->value;
+    }
+    this->hasnew = (newfig != NULL);
+    if (newfig != NULL) {
+        this->newval = newfig->value;
+    }
+}
+
+/* The condition for a conditional write: every byte in the written range
+ * must currently correspond to EXPECTED.
+ */
+struct writecond {
+    figtree_value_t expected;
+    figdifffn_t conflictfn;
+    void* conflictarg;
+    struct pendingdiff pending;
+    byte_index_t next; // first byte in the range not checked yet
+    bool done; // true once the check has passed BYTE_INDEX_MAX
+    bool failed;
+};
+
+void _writecond_conflict(struct writecond* this, byte_index_t left,
+                         byte_index_t right, struct fig* current) {
+    struct fig expected;
+    expected.value = this->expected;
+    this->failed = true;
+    if (this->conflictfn != NULL) {
+        _pendingdiff_add(&this->pending, left, right, current, &expected,
+                         this->conflictfn, this->conflictarg);
+    }
+}
+
+void _writecond_check(struct fig* fig, void* arg) {
+    struct writecond* this = arg;
+    if (fig->irange.left > this->next) {
+        _writecond_conflict(this, this->next, fig->irange.left - 1, NULL);
+    }
+    if (!FT_VALUE_EQUAL(fig->value, this->expected)) {
+        _writecond_conflict(this, fig->irange.left, fig->irange.right, fig);
+    }
+    if (fig->irange.right == BYTE_INDEX_MAX) {
+        this->done = true;
+    } else {
+        this->next = fig->irange.right + 1;
+    }
+}
+
+/* Checks the condition against the live FIGs in the subtree rooted at NODE
+ * (which may be NULL), whose valid interval is VALID, and which must hold
+ * every live FIG in RANGE. The offsets of the ancestors of NODE must have
+ * been pushed down. Returns true if the condition holds.
+ */
+bool _writecond_validate(struct writecond* this, struct ft_node* node,
+                         struct interval* valid, struct interval* range) {
+    this->next = range->left;
+    this->done = false;
+    if (node != NULL) {
+        _ft_walk(node, 0, valid, range, _writecond_check, this);
+    }
+    if (!this->done && this->next <= range->right) {
+        _writecond_conflict(this, this->next, range->right, NULL);
+    }
+    if (this->conflictfn != NULL) {
+        _pendingdiff_flush(&this->pending, this->conflictfn, this->conflictarg);
+    }
+    return !this->failed;
+}
+
+/* Recomputes the summaries of the first PATH_LEN nodes in PATH, bottom-up.
+ * PATH must lead down from the root, one level at a time.
+ */
+void _ft_summarize_path(struct ft_node** path, int path_len) {
+    int pathindex;
+    for (pathindex = path_len - 1; pathindex >= 0; pathindex--) {
+        ftn_summarize(path[pathindex]);
+    }
+}
+
 void _ft_insert(struct figtree* this, struct insertargs* args,
                 struct ft_node** path, int* pathIndices, int* path_len,
                 bool rightcontinuation, struct insertcont* ic) {
@@ -41,6 +358,8 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
        [range->right + 1, star2]. */
 
     int numentries, i;
+    byte_index_t oldleft, oldright;
+    struct interval edgevalid;
 
     memset(ic, 0x00, sizeof(struct insertcont));
 
@@ -49,7 +368,14 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
         struct ft_ent* current;
         struct interval* previval;
         struct interval* currival;
-        ftn_pruneTo(currnode, valid);
+        FTP_COUNT(NODE_VISITS, 1);
+        /* This pushes down the offset of CURRNODE, so that its entries, like
+         * RANGE and VALID, are absolute. Dropping shadowed entries moves the
+         * live ones, so cached value pointers into the node go stale even if
+         * a conditional write fails further down. */
+        if (ftn_pruneTo(currnode, valid)) {
+            _ft_modified(this);
+        }
         numentries = currnode->entries_len;
         current = NULL;
         currival = NULL;
@@ -62,6 +388,18 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
                 int j;
                 struct ft_ent* previous;
 
+                /* Every live FIG in RANGE is in this node or one of its
+                 * subtrees, so report them before the node is modified.
+                 */
+                if (args->cond != NULL &&
+                    !_writecond_validate(args->cond, currnode, valid, range)) {
+                    return;
+                }
+                if (args->shadowfn != NULL) {
+                    _ft_walk(currnode, 0, valid, range, args->shadowfn,
+                             args->shadowarg);
+                }
+
                 // We increment *path_len later
                 path[*path_len] = currnode;
                 if (currival->left < range->left) {
@@ -69,7 +407,7 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
                     ic->hasleftc = true;
                     i_init(&ic->leftc.range, currival->left, range->left - 1);
                     ic->leftc.value = current->value;
-                    ic->leftc.at = subtree_get(&currnode->subtrees[i]);
+                    ic->leftc.at = _ft_child(this, currnode, i);
                     memcpy(&ic->leftc.valid, valid, sizeof(struct interval));
                     i_restrict_range(&ic->leftc.valid, i == 0 ? BYTE_INDEX_MIN :
                                      previval->right + 1,
@@ -103,7 +441,7 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
                     /* After we replace entries i ... j - 1 with the new
                      * entry, we need to continue with what is now subtree j.
                      */
-                    ic->rightc.at = subtree_get(&currnode->subtrees[j]);
+                    ic->rightc.at = _ft_child(this, currnode, j);
                     memcpy(&ic->rightc.valid, valid, sizeof(struct interval));
                     i_restrict_range(&ic->rightc.valid,
                                      previous->irange.right + 1,
@@ -126,13 +464,49 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
                 /* Now that we have created the continuations, we can replace
                  * the appropriate entries in the node with the new one.
                  */
+                oldleft = currival->left;
+                oldright = previous->irange.right;
                 ftn_replaceEntries(currnode, i, j, range, value);
+
+                /* If RANGE extends past the entries it replaced, then part of
+                 * the subtree on that side is now shadowed by the new entry.
+                 * Prune it right away so that subtree summaries stay exact.
+                 */
+                if (range->left < oldleft) {
+                    memcpy(&edgevalid, valid, sizeof(struct interval));
+                    if (range->left == BYTE_INDEX_MIN) {
+                        i_restrict_range(&edgevalid, BYTE_INDEX_MAX,
+                                         BYTE_INDEX_MIN, true);
+                    } else {
+                        i_restrict_range(&edgevalid, previval == NULL ?
+                                         BYTE_INDEX_MIN : previval->right + 1,
+                                         range->left - 1, true);
+                    }
+                    ftn_pruneEdge(_ft_child(this, currnode, i), &edgevalid,
+                                  true);
+                }
+                if (range->right > oldright) {
+                    memcpy(&edgevalid, valid, sizeof(struct interval));
+                    if (range->right == BYTE_INDEX_MAX) {
+                        i_restrict_range(&edgevalid, BYTE_INDEX_MAX,
+                                         BYTE_INDEX_MIN, true);
+                    } else {
+                        i_restrict_range(&edgevalid, range->right + 1,
+                                         i + 1 == currnode->entries_len ?
+                                         BYTE_INDEX_MAX :
+                                         currnode->entries[i + 1].irange.left
+                                         - 1, true);
+                    }
+                    ftn_pruneEdge(_ft_child(this, currnode, i + 1),
+                                  &edgevalid, false);
+                }
+                _ft_summarize_path(path, *path_len);
                 
                 goto treeinsertion;
             } else if (i_rightOf_int(currival, range)) {
                 path[*path_len] = currnode;
                 pathIndices[(*path_len)++] = i;
-                currnode = subtree_get(&currnode->subtrees[i]);
+                currnode = _ft_child(this, currnode, i);
                 /* What if previval and currival are adjacent intervals? Then
                  * the entire subtree can be pruned. This is represented by the
                  * special empty interval.
@@ -144,7 +518,7 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
         }
         path[*path_len] = currnode;
         pathIndices[(*path_len)++] = numentries;
-        currnode = subtree_get(&currnode->subtrees[numentries]);
+        currnode = _ft_child(this, currnode, numentries);
         i_restrict_range(valid, currival == NULL ? BYTE_INDEX_MIN :
                          currival->right + 1, BYTE_INDEX_MAX, true);
     }
@@ -152,6 +526,11 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
     treeinsertion:
     if (currnode == NULL) {
         // In this case, we actually need to do an insertion
+        if (args->cond != NULL) {
+            /* Nothing in RANGE is mapped, so a condition cannot hold. */
+            _writecond_validate(args->cond, NULL, valid, range);
+            return;
+        }
         struct ft_ent toinsert;
         struct ft_node* rv = NULL;
         struct ft_node* topushnode = NULL;
@@ -219,6 +598,7 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
                 if (rightcontinuation && pathindex > finalsharedindex) {
                     pathIndices[finalsharedindex]--;
                 }
+                _ft_summarize_path(path, pathindex);
                 goto endtreeinsertion;
             }
             
@@ -227,8 +607,11 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
             right = subtree_get(&topushnode->subtrees[1]);
         }
 
-        // No parent to push to
-        this->root = topushnode;
+        /* No parent to push to. The root was split into two new children,
+         * and stays in place as the new root.
+         */
+        FTP_COUNT(ROOT_GROWS, 1);
+        ASSERT(topushnode == &this->root, "Split past the root");
         if (rightcontinuation) {
             struct ft_node* nextpathmember = path[0];
             memmove(&pathIndices[1], pathIndices, (*path_len) * sizeof(int));
@@ -251,50 +634,290 @@ void _ft_insert(struct figtree* this, struct insertargs* args,
     }
 }
 
-void ft_write(struct figtree* this, byte_index_t start, byte_index_t end,
-              figtree_value_t value) {
+/* Passes shadowed FIGs on to the caller's callback, if any, after dropping
+ * them from the value index.
+ */
+struct indexedshadow {
+    struct ft_valueindex* valueindex;
+    figfn_t shadowfn;
+    void* shadowarg;
+};
+
+void _ft_shadow_indexed(struct fig* fig, void* arg) {
+    struct indexedshadow* this = arg;
+    fvi_remove(this->valueindex, fig->irange.left, fig->irange.right,
+               fig->value);
+    if (this->shadowfn != NULL) {
+        this->shadowfn(fig, this->shadowarg);
+    }
+}
+
+bool _ft_write(struct figtree* this, byte_index_t start, byte_index_t end,
+               figtree_value_t value, figfn_t shadowfn, void* shadowarg,
+               struct writecond* cond) {
     // Plus one because the height of the tree may increase on insert
     // Plus one because the height of a leaf is 0, not 1
-    int maxdepth = this->root->HEIGHT + 2;
+    int maxdepth = this->root.HEIGHT + 2;
     struct ft_node* path[maxdepth];
     int pathIndices[maxdepth];
     int path_len = 0; // length of both of the above arrays
     struct insertargs iargs;
     struct insertcont starinserts;
     struct insertcont newstarinserts;
+    struct indexedshadow indexed;
+
+    if (this->valueindex != NULL) {
+        indexed.valueindex = this->valueindex;
+        indexed.shadowfn = shadowfn;
+        indexed.shadowarg = shadowarg;
+        shadowfn = _ft_shadow_indexed;
+        shadowarg = &indexed;
+    }
 
     i_init(&iargs.range, start, end);
     iargs.value = value;
-    iargs.at = this->root;
+    iargs.at = &this->root;
     i_init(&iargs.valid, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    iargs.shadowfn = shadowfn;
+    iargs.shadowarg = shadowarg;
+    iargs.cond = cond;
     
     _ft_insert(this, &iargs, path, pathIndices, &path_len, false, &starinserts);
+    if (cond != NULL && cond->failed) {
+        return false;
+    }
+    _ft_modified(this);
+    if (this->valueindex != NULL) {
+        fvi_add(this->valueindex, start, end, value);
+    }
     if (starinserts.hasrightc) {
+        FTP_COUNT(RIGHT_CONTINUATIONS, 1);
         _ft_insert(this, &starinserts.rightc, path, pathIndices, &path_len,
                    true, &newstarinserts);
         ASSERT(!newstarinserts.hasleftc && !newstarinserts.hasrightc,
                "Recursive star insert on right continutation");
     }
     if (starinserts.hasleftc) {
+        FTP_COUNT(LEFT_CONTINUATIONS, 1);
         _ft_insert(this, &starinserts.leftc, path, pathIndices, &path_len,
                    false, &newstarinserts);
         ASSERT(!newstarinserts.hasleftc && !newstarinserts.hasrightc,
                "Recursive star insert on left continuation");
     }
+    return true;
 }
 
-figtree_value_t* ft_lookup(struct figtree* this, byte_index_t location) {
-    struct ft_node* currnode = this->root;
+void ft_write(struct figtree* this, byte_index_t start, byte_index_t end,
+              figtree_value_t value) {
+    FTP_TIMER_START(t0);
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_WRITE, start, end, value);
+    }
+    if (this->buffer != NULL) {
+        _ft_modified(this);
+        ftb_write(this->buffer, start, end, value);
+        if (this->buffer->len >= this->buffer_limit) {
+            ft_flush_write_buffer(this);
+        }
+    } else {
+        _ft_write(this, start, end, value, NULL, NULL, NULL);
+    }
+    FTP_TIMER_STOP(WRITE, t0);
+}
+
+void ft_set_write_buffer(struct figtree* this, size_t limit) {
+    if (limit == 0) {
+        if (this->buffer != NULL) {
+            ft_flush_write_buffer(this);
+            ftb_dealloc(this->buffer);
+            mem_free(this->buffer);
+            this->buffer = NULL;
+        }
+    } else if (this->buffer == NULL) {
+        this->buffer = mem_alloc(sizeof(struct ft_buffer));
+        ftb_init(this->buffer);
+    }
+    this->buffer_limit = limit;
+    if (this->buffer != NULL && this->buffer->len >= limit) {
+        ft_flush_write_buffer(this);
+    }
+}
+
+void ft_set_trace(struct figtree* this, struct ft_trace* trace) {
+    struct figtree_iter* iter;
+    struct fig fig;
+
+    /* A replay starts from an empty tree, so begin with what is already in
+     * this one. This is read before TRACE is set, so it is not traced. */
+    this->trace = NULL;
+    if (trace != NULL) {
+        iter = ft_read(this, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+        while (fti_next(iter, &fig)) {
+            ftr_record(trace, FTR_WRITE, fig.irange.left, fig.irange.right,
+                       fig.value);
+        }
+        fti_free(iter);
+    }
+    this->trace = trace;
+}
+
+void ft_flush_write_buffer(struct figtree* this) {
+    struct ft_ent* ent;
+    size_t i;
+    if (this->buffer == NULL) {
+        return;
+    }
+    /* The buffered writes no longer overlap, so their order does not matter;
+     * applying them in sorted order keeps consecutive writes on the same
+     * paths through the tree.
+     */
+    for (i = 0; i < this->buffer->len; i++) {
+        ent = &this->buffer->ents[i];
+        _ft_write(this, ent->irange.left, ent->irange.right, ent->value, NULL,
+                  NULL, NULL);
+    }
+    ftb_clear(this->buffer);
+}
+
+void ft_write_exchange(struct figtree* this, byte_index_t start,
+                       byte_index_t end, figtree_value_t value,
+                       figfn_t shadowfn, void* shadowarg) {
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_WRITE, start, end, value);
+    }
+    ft_flush_write_buffer(this);
+    _ft_write(this, start, end, value, shadowfn, shadowarg, NULL);
+}
+
+bool ft_write_if(struct figtree* this, byte_index_t start, byte_index_t end,
+                 figtree_value_t expected, figtree_value_t value,
+                 figdifffn_t conflictfn, void* conflictarg) {
+    struct writecond cond;
+    memset(&cond, 0x00, sizeof(cond));
+    cond.expected = expected;
+    cond.conflictfn = conflictfn;
+    cond.conflictarg = conflictarg;
+    ft_flush_write_buffer(this);
+    if (!_ft_write(this, start, end, value, NULL, NULL, &cond)) {
+        return false;
+    }
+    /* Only a write that happened changes what a replay must see. */
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_WRITE, start, end, value);
+    }
+    return true;
+}
+
+void _ft_index_fig(struct fig* fig, void* arg) {
+    fvi_add(arg, fig->irange.left, fig->irange.right, fig->value);
+}
+
+void ft_index_values(struct figtree* this) {
+    struct interval all;
+    if (this->valueindex != NULL) {
+        return;
+    }
+    ft_flush_write_buffer(this);
+    this->valueindex = fvi_new();
+    i_init(&all, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    _ft_walk(&this->root, 0, &all, &all, _ft_index_fig, this->valueindex);
+}
+
+/* Filters the FIGs in a scan down to those with a single value. */
+struct valuefilter {
+    figtree_value_t value;
+    figfn_t fn;
+    void* arg;
+};
+
+void _ft_filter_value(struct fig* fig, void* arg) {
+    struct valuefilter* this = arg;
+    if (FT_VALUE_EQUAL(fig->value, this->value)) {
+        this->fn(fig, this->arg);
+    }
+}
+
+void ft_ranges_for_value(struct figtree* this, figtree_value_t value,
+                         figfn_t fn, void* arg) {
+    struct valuefilter filter;
+    struct interval all;
+    ft_flush_write_buffer(this);
+    if (this->valueindex != NULL) {
+        fvi_foreach(this->valueindex, value, fn, arg);
+        return;
+    }
+    filter.value = value;
+    filter.fn = fn;
+    filter.arg = arg;
+    i_init(&all, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    _ft_walk(&this->root, 0, &all, &all, _ft_filter_value, &filter);
+}
+
+/* Returns a pointer to the value at LOCATION, as ft_lookup does. If FOUND is
+ * not NULL and there is a value, FOUND is set to the range of bytes around
+ * LOCATION that have that same value through the same pointer.
+ */
+figtree_value_t* _ft_lookup(struct figtree* this, byte_index_t location,
+                            struct interval* found) {
+    struct ft_node* currnode = &this->root;
+    int64_t target = location; // LOCATION, relative to the offsets so far
+    int64_t left = BYTE_INDEX_MIN, right = BYTE_INDEX_MAX;
+
+    if (this->buffer != NULL) {
+        struct ft_ent* buffered = ftb_lookup(this->buffer, location);
+        size_t i;
+        if (buffered != NULL) {
+            if (found != NULL) {
+                memcpy(found, &buffered->irange, sizeof(struct interval));
+            }
+            return &buffered->value;
+        }
+        /* The FIG from the tree, if any, only shows between the buffered
+         * writes on either side of LOCATION.
+         */
+        i = ftb_find(this->buffer, location);
+        if (i != 0) {
+            left = (int64_t) this->buffer->ents[i - 1].irange.right + 1;
+        }
+        if (i != this->buffer->len) {
+            right = (int64_t) this->buffer->ents[i].irange.left - 1;
+        }
+    }
 
     outerloop:
     while (currnode != NULL) {
         int i;
+        FTP_COUNT(NODE_VISITS, 1);
+        target -= currnode->offset;
+        if (target < BYTE_INDEX_MIN || target > BYTE_INDEX_MAX) {
+            /* LOCATION lies outside of every entry in the subtree. */
+            return NULL;
+        }
+        if (currnode->compressed) {
+            struct interval packedival;
+            figtree_value_t* value = ftn_findPacked(currnode,
+                                                    (byte_index_t) target,
+                                                    &packedival);
+            if (value != NULL && found != NULL) {
+                int64_t shift = (int64_t) location - target;
+                i_init(found,
+                       (byte_index_t) MAX(left, packedival.left + shift),
+                       (byte_index_t) MIN(right, packedival.right + shift));
+            }
+            return value;
+        }
         for (i = 0; i < currnode->entries_len; i++) {
             struct ft_ent* current = &currnode->entries[i];
             struct interval* currival = &current->irange;
-            if (i_contains_val(currival, location)) {
+            if (i_contains_val(currival, (byte_index_t) target)) {
+                if (found != NULL) {
+                    int64_t shift = (int64_t) location - target;
+                    i_init(found,
+                           (byte_index_t) MAX(left, currival->left + shift),
+                           (byte_index_t) MIN(right, currival->right + shift));
+                }
                 return &current->value;
-            } else if (currival->left > location) {
+            } else if (currival->left > target) {
                 currnode = subtree_get(&currnode->subtrees[i]);
                 goto outerloop;
             }
@@ -305,117 +928,1274 @@ figtree_value_t* ft_lookup(struct figtree* this, byte_index_t location) {
     return NULL;
 }
 
-/* Stores one node in a path of nodes to reach the current point in the
- * iteration.
- */
-struct figtree_iterstate {
-    struct ft_node* node;
-    int pos; // index of the next subtree to look at
-    struct interval valid;
-};
-
-void ft_iterstate_init(struct figtree_iterstate* this, struct ft_node* node,
-                       struct interval* valid) {
-    this->node = node;
-    this->pos = -1; // index of the entry we just looked at
-    memcpy(&this->valid, valid, sizeof(struct interval));
-}
-
-/* This is really just a header for an array of figtree_iterstates.
- * The current position is given by the current entry of the iterstate
- * at index DEPTH.
+/* Same as _ft_lookup, but first looks for LOCATION among the FIGs that this
+ * thread looked up in the tree since it was last modified.
  */
-struct figtree_iter {
-    int depth; // Index into following array
-};
+figtree_value_t* _ft_lookup_cached(struct figtree* this,
+                                   byte_index_t location) {
+    struct ft_lookupcache* cache = &ft_lookupcache_local;
+    struct ft_cachedfig* slot;
+    struct interval found;
+    figtree_value_t* value;
+    int i;
 
-/* Returns an iterator over the closed interval [START, END]. */
-struct figtree_iter* ft_read(struct figtree* this,
-                             byte_index_t start, byte_index_t end) {
-    struct interval initvalid;
-    struct ft_ent* entry;
-    struct figtree_iter* iterator =
-        mem_alloc(sizeof(struct figtree_iter) +
-                  (sizeof(struct figtree_iterstate) *
-                   (this->root->HEIGHT + 2)));
-    struct figtree_iterstate* iterstates =
-        (struct figtree_iterstate*) (iterator + 1);
-    struct figtree_iterstate* rs = &iterstates[0];
-    struct figtree_iterstate* ors; /* temp. pointer to change rs */
-    iterator->depth = 0;
+    for (i = 0; i < FT_LOOKUP_CACHE_SLOTS; i++) {
+        slot = &cache->slots[i];
+        if (slot->tree == this && slot->epoch == this->epoch &&
+            slot->generation == this->generation &&
+            i_contains_val(&slot->range, location)) {
+            cache->hits++;
+            FTP_COUNT(LOOKUP_CACHE_HITS, 1);
+            return slot->value;
+        }
+    }
+    cache->misses++;
+    FTP_COUNT(LOOKUP_CACHE_MISSES, 1);
 
-    i_init(&initvalid, start, end);
-    ft_iterstate_init(rs, this->root, &initvalid);
+    value = _ft_lookup(this, location, &found);
+    if (value != NULL) {
+        slot = &cache->slots[cache->next++ % FT_LOOKUP_CACHE_SLOTS];
+        slot->tree = this;
+        slot->generation = this->generation;
+        slot->epoch = this->epoch;
+        memcpy(&slot->range, &found, sizeof(struct interval));
+        slot->value = value;
+    }
+    return value;
+}
 
-    continueouterloop:
-    while (rs->node != NULL) {
-        struct interval* previval;
-        struct interval* currival = NULL;
-        while (++rs->pos < rs->node->entries_len) {
-            entry = &rs->node->entries[rs->pos];
-            previval = currival;
-            currival = &entry->irange;
-            if (i_contains_val(currival, start)) {
-                goto breakouterloop;
-            } else if (i_rightOf_val(currival, start)) {
-                ors = rs;
-                rs = &iterstates[++iterator->depth];
-                ft_iterstate_init(rs,
-                                  subtree_get(&ors->node->subtrees[ors->pos]),
-                                  &ors->valid);
-                i_restrict_range(&rs->valid, previval == NULL ?
-                                 BYTE_INDEX_MIN : (previval->right + 1),
-                                 currival->left - 1, false);
-                goto continueouterloop;
-            }
-        }
-        ors = rs;
-        rs = &iterstates[++iterator->depth];
-        ft_iterstate_init(rs, subtree_get(&ors->node->subtrees[ors->pos]),
-                          &ors->valid);
-        i_restrict_range(&rs->valid, currival == NULL ?
-                         BYTE_INDEX_MIN: (currival->right + 1), BYTE_INDEX_MAX,
-                         false);
+figtree_value_t* ft_lookup(struct figtree* this, byte_index_t location) {
+    figtree_value_t* result;
+    FTP_TIMER_START(t0);
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_LOOKUP, location, location, 0);
     }
-    breakouterloop:
-    while (iterator->depth != -1 &&
-           (rs->node == NULL || rs->pos == rs->node->entries_len ||
-            i_leftOf_int(&rs->valid, &rs->node->entries[rs->pos].irange))) {
-        rs = &iterstates[--iterator->depth];
+    if (this->lookup_cache) {
+        result = _ft_lookup_cached(this, location);
+    } else {
+        result = _ft_lookup(this, location, NULL);
     }
-    
-    return iterator;
+    FTP_TIMER_STOP(LOOKUP, t0);
+    return result;
 }
 
-void ft_dealloc(struct figtree* this) {
-    ftn_free(this->root);
-    this->root = NULL;
+void ft_set_lookup_cache(struct figtree* this, bool enabled) {
+    this->lookup_cache = enabled;
 }
 
-/* Populates NEXT with the next fig (i.e. the next range of bytes and the
- * value it corresponds to), or returns false if there is no next fig.
- */
-bool fti_next(struct figtree_iter* this, struct fig* next) {
-    struct figtree_iterstate* states = (struct figtree_iterstate*) (this + 1);
-    struct figtree_iterstate* rs;
-    struct interval* oldvalid;
-    struct ft_ent* entry; // the current entry
+void ft_lookup_cache_counts(uint64_t* hits, uint64_t* misses) {
+    *hits = ft_lookupcache_local.hits;
+    *misses = ft_lookupcache_local.misses;
+}
 
-    /* At the end of the iteration, we backtrack up the tree past the root since
-     * all nodes appear "invalid" given the restricted valid interval.
-     */
-    if (this->depth == -1) {
-        return false;
+void _ft_unindex_fig(struct fig* fig, void* arg) {
+    fvi_remove(arg, fig->irange.left, fig->irange.right, fig->value);
+}
+
+/* Initializes VALID to [LEFT, RIGHT], or to the empty interval if LEFT is
+ * greater than RIGHT.
+ */
+void _ft_gap(struct interval* valid, int64_t left, int64_t right) {
+    i_init(valid, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    if (left > right) {
+        i_restrict_range(valid, BYTE_INDEX_MAX, BYTE_INDEX_MIN, true);
+    } else {
+        i_init(valid, (byte_index_t) left, (byte_index_t) right);
     }
-    rs = &states[this->depth];
-    ASSERT (rs->pos < rs->node->entries_len,
-            "Iterator starting at end of interior node");
-    entry = &rs->node->entries[rs->pos];
+}
 
-    // Populate next with what we're going to yield
-    memcpy(&next->irange, &entry->irange, sizeof(struct interval));
-    i_restrict_int(&next->irange, &rs->valid, false);
-    next->value = entry->value;
+/* Removes the mapping for [START, END]. This descends to the highest node N
+ * with an entry that overlaps the range; the entries of N that lie inside it
+ * are dropped along with the subtrees between them, the subtrees on either
+ * side are pruned along their inner edges, and what is left of those two is
+ * joined under N through the last entry of the left one. The nodes along the
+ * pruned edges, and then N and its ancestors, are rebalanced bottom-up, and
+ * the root is dropped for as long as it is left without entries.
+ */
+void _ft_erase(struct figtree* this, byte_index_t start, byte_index_t end) {
+    int maxdepth = this->root.HEIGHT + 1;
+    struct ft_node* path[maxdepth];
+    int pathIndices[maxdepth];
+    int path_len = 0; // length of both of the above arrays
+    struct ft_node* node = &this->root;
+    struct ft_node* left;
+    struct ft_node* right;
+    struct ft_node* other;
+    struct ft_ent ents[FT_SPLITLIMIT];
+    struct subtree_ptr subs[FT_SPLITLIMIT + 1];
+    struct ft_ent separator;
+    struct interval valid;
+    struct interval range;
+    bool keepleft, keepright, joined, swapped;
+    figtree_value_t value;
+    byte_index_t rightend;
+    int64_t rootoffset;
+    int first, last, at, n, s, i;
+
+    ASSERT(start <= end, "ft_erase called on an empty range");
+    _ft_modified(this);
+    if (this->valueindex != NULL) {
+        i_init(&valid, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+        i_init(&range, start, end);
+        _ft_walk(&this->root, 0, &valid, &range, _ft_unindex_fig,
+                 this->valueindex);
+    }
+
+    while (true) {
+        if (node == NULL) {
+            return; // nothing in the range is mapped
+        }
+        FTP_COUNT(NODE_VISITS, 1);
+        ftn_pushOffset(node);
+        for (first = 0; first < node->entries_len &&
+                 node->entries[first].irange.right < start; first++) {
+            /* Do nothing; the loop condition does all the work. */
+        }
+        if (first < node->entries_len &&
+            node->entries[first].irange.left <= end) {
+            break;
+        }
+        path[path_len] = node;
+        pathIndices[path_len++] = first;
+        node = _ft_child(this, node, first);
+    }
+    for (last = first; last + 1 < node->entries_len &&
+             node->entries[last + 1].irange.left <= end; last++) {
+        /* Do nothing; the loop condition does all the work. */
+    }
+    keepleft = node->entries[first].irange.left < start;
+    keepright = node->entries[last].irange.right > end;
+
+    if (first == last && keepleft && keepright) {
+        /* The range is a hole in a single entry. Keep its left part in place,
+         * and write its right part back as a new entry.
+         */
+        rightend = node->entries[first].irange.right;
+        value = node->entries[first].value;
+        node->entries[first].irange.right = start - 1;
+        ftn_summarize(node);
+        _ft_summarize_path(path, path_len);
+        if (this->valueindex != NULL) {
+            fvi_remove(this->valueindex, end + 1, rightend, value);
+        }
+        _ft_write(this, end + 1, rightend, value, NULL, NULL, NULL);
+        return;
+    }
+
+    if (keepleft) {
+        node->entries[first].irange.right = start - 1;
+    } else {
+        _ft_gap(&valid, first == 0 ? BYTE_INDEX_MIN :
+                (int64_t) node->entries[first - 1].irange.right + 1,
+                (int64_t) start - 1);
+        ftn_pruneEdge(_ft_child(this, node, first), &valid, true);
+    }
+    if (keepright) {
+        node->entries[last].irange.left = end + 1;
+    } else {
+        _ft_gap(&valid, (int64_t) end + 1,
+                last + 1 == node->entries_len ? BYTE_INDEX_MAX :
+                (int64_t) node->entries[last + 1].irange.left - 1);
+        ftn_pruneEdge(_ft_child(this, node, last + 1), &valid, false);
+    }
+    for (i = first + 1; i <= last; i++) {
+        subtree_free(&node->subtrees[i]);
+    }
+
+    /* Join what is left on either side of the range into one subtree, or
+     * into two around the last entry of the left one if both have entries.
+     */
+    left = keepleft ? NULL : _ft_child(this, node, first);
+    right = keepright ? NULL : _ft_child(this, node, last + 1);
+    joined = left != NULL && left->subtree_figs != 0 &&
+             right != NULL && right->subtree_figs != 0;
+    swapped = false;
+    if (joined) {
+        ftn_removeMax(left, &separator);
+    } else {
+        if (left == NULL || (left->subtree_figs == 0 && right != NULL)) {
+            other = left;
+            left = right;
+            right = other;
+            swapped = true;
+        }
+        if (right != NULL) {
+            ftn_free(right);
+        }
+        if (left == NULL && node->HEIGHT != 0) {
+            left = ftn_new(node->HEIGHT - 1, true);
+        }
+    }
+
+    n = 0;
+    s = 0;
+    for (i = 0; i < first; i++) {
+        ents[n++] = node->entries[i];
+        subs[s++] = node->subtrees[i];
+    }
+    if (keepleft) {
+        ents[n++] = node->entries[first];
+        subs[s++] = node->subtrees[first];
+    }
+    at = s;
+    subtree_set(&subs[s++], left);
+    if (joined) {
+        ents[n++] = separator;
+        subtree_set(&subs[s++], right);
+    }
+    if (keepright) {
+        ents[n++] = node->entries[last];
+        subs[s++] = node->subtrees[last + 1];
+    }
+    for (i = last + 1; i < node->entries_len; i++) {
+        ents[n++] = node->entries[i];
+        subs[s++] = node->subtrees[i + 1];
+    }
+    memcpy(node->entries, ents, n * sizeof(struct ft_ent));
+    memcpy(node->subtrees, subs, s * sizeof(struct subtree_ptr));
+    node->entries_len = n;
+    node->subtrees_len = s;
+
+    if (joined) {
+        ftn_rebalanceEdge(left, true);
+        ftn_rebalanceEdge(right, false);
+        ftn_rebalanceChild(node, at + 1);
+    } else {
+        ftn_rebalanceEdge(left, !swapped);
+    }
+    ftn_rebalanceChild(node, at);
+    for (i = path_len - 1; i >= 0; i--) {
+        ftn_rebalanceChild(path[i], pathIndices[i]);
+    }
+
+    while (this->root.entries_len == 0 && this->root.HEIGHT != 0) {
+        rootoffset = this->root.offset;
+        ftn_move(&this->root, _ft_child(this, &this->root, 0));
+        this->root.offset += rootoffset;
+    }
+}
+
+void ft_erase(struct figtree* this, byte_index_t start, byte_index_t end) {
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_ERASE, start, end, 0);
+    }
+    ft_flush_write_buffer(this);
+    _ft_erase(this, start, end);
+}
+
+/* Packs the leaves below NODE, which is not a leaf itself. */
+void _ft_compress_leaves(struct ft_node* node) {
+    struct ft_node* child;
+    int i;
+    for (i = 0; i < node->subtrees_len; i++) {
+        if ((child = subtree_get(&node->subtrees[i])) == NULL) {
+            continue;
+        }
+        if (child->HEIGHT == 0) {
+            subtree_set(&node->subtrees[i], ftn_pack(child));
+        } else {
+            _ft_compress_leaves(child);
+        }
+    }
+}
+
+void ft_compress_leaves(struct figtree* this) {
+    _ft_modified(this);
+    if (this->root.HEIGHT != 0) {
+        _ft_compress_leaves(&this->root);
+    }
+}
+
+/* Copies the first FIG of a traversal into ARG, and stops it. */
+bool _ft_first_fig(struct fig* fig, void* arg) {
+    memcpy(arg, fig, sizeof(struct fig));
+    return false;
+}
+
+void ft_shift(struct figtree* this, byte_index_t from, int64_t delta) {
+    struct ft_node* node;
+    struct ft_node* child;
+    struct fig fig;
+    figtree_value_t* value;
+    int i, j;
+
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_SHIFT, from, from,
+                   (figtree_value_t) delta);
+    }
+    ft_flush_write_buffer(this);
+    if (delta == 0) {
+        return;
+    }
+    _ft_modified(this);
+    if (delta > 0) {
+        ASSERT(delta <= BYTE_INDEX_MAX &&
+               ft_count_mapped(this, MAX(from, BYTE_INDEX_MAX -
+                                         (byte_index_t) (delta - 1)),
+                               BYTE_INDEX_MAX) == 0,
+               "ft_shift would move mapped bytes past BYTE_INDEX_MAX");
+    } else {
+        ASSERT(-delta <= from,
+               "ft_shift would move bytes before BYTE_INDEX_MIN");
+        _ft_erase(this, from - (byte_index_t) -delta, from - 1);
+    }
+
+    /* Split the FIG that spans FROM, if any, by writing its right part again,
+     * so that every entry lies entirely on one side of FROM.
+     */
+    if (from != BYTE_INDEX_MIN &&
+        (value = _ft_lookup(this, from, NULL)) != NULL &&
+        _ft_lookup(this, from - 1, NULL) == value) {
+        _ft_visit(&this->root, 0, from, BYTE_INDEX_MAX, _ft_first_fig, &fig);
+        _ft_write(this, from, fig.irange.right, fig.value, NULL, NULL, NULL);
+    }
+    if (this->valueindex != NULL) {
+        fvi_shift(this->valueindex, from, delta);
+    }
+
+    /* In each node on the path to FROM, the entries past FROM are moved
+     * directly, and the subtrees past FROM are moved through their offsets.
+     * The summaries do not change.
+     */
+    for (node = &this->root; node != NULL; node = _ft_child(this, node, i)) {
+        FTP_COUNT(NODE_VISITS, 1);
+        ftn_pushOffset(node);
+        for (i = 0; i < node->entries_len &&
+                 node->entries[i].irange.left < from; i++) {
+            /* Do nothing; the loop condition does all the work. */
+        }
+        for (j = i; j < node->entries_len; j++) {
+            node->entries[j].irange.left += (byte_index_t) delta;
+            node->entries[j].irange.right += (byte_index_t) delta;
+        }
+        for (j = i + 1; j < node->subtrees_len; j++) {
+            if ((child = subtree_get(&node->subtrees[j])) != NULL) {
+                child->offset += delta;
+            }
+        }
+    }
+}
+
+/* Adds the number of bytes and FIGs in the subtree rooted at NODE, whose
+ * valid interval is VALID, that overlap RANGE to *BYTES and *FIGS. Subtrees
+ * that lie entirely within RANGE are answered from their summaries, so only
+ * the paths to the two ends of RANGE are visited. BASE is the sum of the
+ * offsets of the ancestors of NODE.
+ */
+void _ft_count(struct ft_node* node, int64_t base, struct interval* valid,
+               struct interval* range, uint64_t* bytes, uint64_t* figs) {
+    struct ft_node leaf;
+    struct interval window;
+    struct interval gap;
+    struct interval scratch;
+    byte_index_t gapleft = BYTE_INDEX_MIN;
+    bool gapempty = false;
+    int i;
+
+    if (node == NULL || !i_overlaps(valid, range)) {
+        return;
+    }
+    if (i_contains_int(range, valid)) {
+        *bytes += node->subtree_bytes;
+        *figs += node->subtree_figs;
+        return;
+    }
+
+    node = ftn_view(node, &leaf);
+    memcpy(&window, valid, sizeof(struct interval));
+    i_restrict_int(&window, range, false);
+    base += node->offset;
+
+    for (i = 0; i <= node->entries_len; i++) {
+        struct interval* currival = i == node->entries_len ? NULL :
+            _ft_range(node, i, base, &scratch);
+
+        if (!gapempty && (currival == NULL || currival->left > gapleft)) {
+            i_init(&gap, gapleft, currival == NULL ? BYTE_INDEX_MAX :
+                   currival->left - 1);
+            if (i_overlaps(&gap, &window)) {
+                i_restrict_int(&gap, valid, false);
+                _ft_count(subtree_get(&node->subtrees[i]), base, &gap, range,
+                          bytes, figs);
+            }
+        }
+
+        if (currival == NULL || i_rightOf_int(currival, &window)) {
+            break;
+        }
+
+        if (i_overlaps(currival, &window)) {
+            *bytes += (uint64_t) (MIN(currival->right, window.right) -
+                                  MAX(currival->left, window.left)) + 1;
+            (*figs)++;
+        }
+
+        gapempty = (currival->right == BYTE_INDEX_MAX);
+        gapleft = currival->right + 1;
+    }
+}
+
+uint64_t ft_count_mapped(struct figtree* this, byte_index_t start,
+                         byte_index_t end) {
+    struct interval range, valid;
+    uint64_t bytes = 0, figs = 0;
+    ft_flush_write_buffer(this);
+    i_init(&range, start, end);
+    i_init(&valid, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    _ft_count(&this->root, 0, &valid, &range, &bytes, &figs);
+    return bytes;
+}
+
+uint64_t ft_count_figs(struct figtree* this, byte_index_t start,
+                       byte_index_t end) {
+    struct interval range, valid;
+    uint64_t bytes = 0, figs = 0;
+    ft_flush_write_buffer(this);
+    i_init(&range, start, end);
+    i_init(&valid, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    _ft_count(&this->root, 0, &valid, &range, &bytes, &figs);
+    return figs;
+}
+
+/* Adds the shape of the subtree rooted at NODE, whose valid interval is
+ * VALID (possibly empty), to STATS. BASE is the sum of the offsets of the
+ * ancestors of NODE.
+ */
+void _ft_stats(struct ft_node* node, int64_t base, struct interval* valid,
+               struct ft_stats* stats) {
+    struct ft_node leaf;
+    struct interval gap;
+    struct interval scratch;
+    byte_index_t gapleft = BYTE_INDEX_MIN;
+    bool gapempty = false;
+    int i;
+
+    ASSERT(node->HEIGHT < FT_STATS_MAX_HEIGHT, "Tree too tall for ft_stats");
+    stats->allocated_bytes += ftn_size(node);
+    stats->compressed_leaves += node->compressed;
+    node = ftn_view(node, &leaf);
+    stats->nodes++;
+    stats->nodes_per_level[node->HEIGHT]++;
+    stats->entries_per_node[node->entries_len]++;
+    stats->entries += (uint64_t) node->entries_len;
+    base += node->offset;
+
+    for (i = 0; i <= node->entries_len; i++) {
+        struct interval* currival = i == node->entries_len ? NULL :
+            _ft_range(node, i, base, &scratch);
+        struct ft_node* subtree = subtree_get(&node->subtrees[i]);
+
+        if (subtree != NULL) {
+            if (gapempty || (currival != NULL && currival->left == gapleft)) {
+                i_init(&gap, BYTE_INDEX_MAX, BYTE_INDEX_MIN);
+                gap.nonempty = false;
+            } else {
+                i_init(&gap, gapleft, currival == NULL ? BYTE_INDEX_MAX :
+                       currival->left - 1);
+                i_restrict_int(&gap, valid, true);
+            }
+            _ft_stats(subtree, base, &gap, stats);
+        }
+
+        if (currival == NULL) {
+            break;
+        }
+        if (valid->nonempty && i_overlaps(currival, valid)) {
+            stats->live_entries++;
+            stats->mapped_bytes +=
+                (uint64_t) (MIN(currival->right, valid->right) -
+                            MAX(currival->left, valid->left)) + 1;
+        } else {
+            stats->shadowed_entries++;
+        }
+
+        gapempty = (currival->right == BYTE_INDEX_MAX);
+        gapleft = currival->right + 1;
+    }
+}
+
+void ft_stats(struct figtree* this, struct ft_stats* stats) {
+    struct interval all;
+
+    memset(stats, 0x00, sizeof(struct ft_stats));
+    i_init(&all, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    stats->height = this->root.HEIGHT;
+    _ft_stats(&this->root, 0, &all, stats);
+
+    /* A node can hold one entry fewer than FT_SPLITLIMIT between writes. */
+    stats->fill_factor = (double) stats->entries /
+        ((double) stats->nodes * (FT_SPLITLIMIT - 1));
+    /* The root is part of the tree itself. */
+    stats->allocated_bytes -= sizeof(struct ft_node);
+    if (this->valueindex != NULL) {
+        stats->allocated_bytes += fvi_allocated(this->valueindex);
+    }
+    if (this->buffer != NULL) {
+        stats->buffered_ranges = this->buffer->len;
+        stats->allocated_bytes += sizeof(struct ft_buffer) +
+            this->buffer->cap * sizeof(struct ft_ent);
+    }
+}
+
+/* The chunks found so far by ft_split. SEEN counts the FIGs in RANGE that
+ * precede the current position in the traversal.
+ */
+struct splitstate {
+    struct interval range;
+    uint64_t seen;
+    uint64_t per_chunk;
+    struct interval* chunks;
+    int chunks_len;
+    int chunks_cap;
+    byte_index_t chunkleft;
+};
+
+/* Ends the current chunk, if it should end, after the FIG ending at RIGHT. */
+void _splitstate_advance(struct splitstate* this, byte_index_t right) {
+    if (this->seen >= this->per_chunk * (this->chunks_len + 1) &&
+        this->chunks_len + 1 < this->chunks_cap && right < this->range.right) {
+        i_init(&this->chunks[this->chunks_len++], this->chunkleft, right);
+        this->chunkleft = right + 1;
+    }
+}
+
+/* Walks the subtree rooted at NODE in order, adding the FIG counts of whole
+ * subtrees from their summaries, and only descending into the subtrees in
+ * which a chunk has to end. BASE is the sum of the offsets of the ancestors
+ * of NODE.
+ */
+void _ft_split(struct ft_node* node, int64_t base, struct interval* valid,
+               struct splitstate* this) {
+    struct ft_node leaf;
+    struct interval gap;
+    struct interval scratch;
+    byte_index_t gapleft = BYTE_INDEX_MIN;
+    bool gapempty = false;
+    int i;
+
+    if (node != NULL) {
+        node = ftn_view(node, &leaf);
+        base += node->offset;
+    }
+    for (i = 0; node != NULL && i <= node->entries_len; i++) {
+        struct interval* currival = i == node->entries_len ? NULL :
+            _ft_range(node, i, base, &scratch);
+
+        if (!gapempty && (currival == NULL || currival->left > gapleft)) {
+            i_init(&gap, gapleft, currival == NULL ? BYTE_INDEX_MAX :
+                   currival->left - 1);
+            if (i_overlaps(&gap, valid) && i_overlaps(&gap, &this->range)) {
+                uint64_t bytes = 0, figs = 0;
+                struct ft_node* subtree = subtree_get(&node->subtrees[i]);
+                i_restrict_int(&gap, valid, false);
+                _ft_count(subtree, base, &gap, &this->range, &bytes, &figs);
+                if (this->seen + figs >=
+                    this->per_chunk * (this->chunks_len + 1) &&
+                    this->chunks_len + 1 < this->chunks_cap) {
+                    _ft_split(subtree, base, &gap, this);
+                } else {
+                    this->seen += figs;
+                }
+            }
+        }
+
+        if (currival == NULL || i_rightOf_int(currival, &this->range)) {
+            break;
+        }
+
+        if (i_overlaps(currival, &this->range)) {
+            this->seen++;
+            _splitstate_advance(this, currival->right);
+        }
+
+        gapempty = (currival->right == BYTE_INDEX_MAX);
+        gapleft = currival->right + 1;
+    }
+}
+
+int ft_split(struct figtree* this, byte_index_t start, byte_index_t end,
+             struct interval* chunks, int max_chunks) {
+    struct splitstate state;
+    struct interval all;
+    uint64_t total = ft_count_figs(this, start, end);
+
+    ASSERT(max_chunks > 0, "ft_split needs room for at least one chunk");
+    i_init(&state.range, start, end);
+    i_init(&all, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    state.seen = 0;
+    state.per_chunk = (total + max_chunks - 1) / max_chunks;
+    state.chunks = chunks;
+    state.chunks_len = 0;
+    state.chunks_cap = max_chunks;
+    state.chunkleft = start;
+    if (total > 1) {
+        _ft_split(&this->root, 0, &all, &state);
+    }
+    i_init(&chunks[state.chunks_len++], state.chunkleft, end);
+
+    return state.chunks_len;
+}
+
+/* Shared by the threads of ft_foreach_parallel. NEXT is the first chunk that
+ * no thread has claimed yet.
+ */
+struct parscan {
+    struct figtree* tree;
+    struct interval* chunks;
+    int num_chunks;
+    int next;
+    figchunkfn_t fn;
+    void* arg;
+};
+
+/* Binds a FIG callback to the chunk it is scanning. */
+struct parchunk {
+    struct parscan* scan;
+    int chunk;
+};
+
+bool _parchunk_visit(struct fig* fig, void* arg) {
+    struct parchunk* this = arg;
+    return this->scan->fn(fig, this->chunk, this->scan->arg);
+}
+
+void* _parscan_run(void* arg) {
+    struct parscan* this = arg;
+    struct parchunk chunk;
+    chunk.scan = this;
+    while ((chunk.chunk = __atomic_fetch_add(&this->next, 1,
+                                             __ATOMIC_RELAXED)) <
+           this->num_chunks) {
+        _ft_visit(&this->tree->root, 0, this->chunks[chunk.chunk].left,
+                  this->chunks[chunk.chunk].right, _parchunk_visit, &chunk);
+    }
+    return NULL;
+}
+
+void ft_foreach_parallel(struct figtree* this, struct interval* chunks,
+                         int num_chunks, int num_threads, figchunkfn_t fn,
+                         void* arg) {
+    struct parscan scan;
+    pthread_t* threads;
+    int i;
+
+    ft_flush_write_buffer(this);
+    for (i = 0; this->trace != NULL && i < num_chunks; i++) {
+        ftr_record(this->trace, FTR_READ, chunks[i].left, chunks[i].right, 0);
+    }
+    scan.tree = this;
+    scan.chunks = chunks;
+    scan.num_chunks = num_chunks;
+    scan.next = 0;
+    scan.fn = fn;
+    scan.arg = arg;
+
+    /* The calling thread is one of the workers. */
+    num_threads = MAX(MIN(num_threads, num_chunks), 1);
+    threads = mem_alloc(num_threads * sizeof(pthread_t));
+    for (i = 0; i < num_threads - 1; i++) {
+        ASSERT(pthread_create(&threads[i], NULL, _parscan_run, &scan) == 0,
+               "Could not start a scan thread");
+    }
+    _parscan_run(&scan);
+    for (i = 0; i < num_threads - 1; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    mem_free(threads);
+}
+
+/* Stores one node in a path of nodes to reach the current point in the
+ * iteration.
+ */
+struct figtree_iterstate {
+    struct ft_node* node;
+    struct ft_node* linked; // NODE as its parent links to it (see ftn_view)
+    int pos; // index of the next subtree to look at
+    int64_t base; // sum of the offsets of NODE and its ancestors
+    struct interval valid;
+    struct interval bounds; // the valid interval, ignoring the range read
+};
+
+/* BASE is the sum of the offsets of the ancestors of NODE. If NODE is
+ * compressed, it is decoded into LEAF.
+ */
+void ft_iterstate_init(struct figtree_iterstate* this, struct ft_node* node,
+                       struct ft_node* leaf, int64_t base,
+                       struct interval* valid, struct interval* bounds) {
+    this->node = ftn_view(node, leaf);
+    this->linked = node;
+    this->pos = -1; // index of the entry we just looked at
+    this->base = node == NULL ? base : base + node->offset;
+    memcpy(&this->valid, valid, sizeof(struct interval));
+    memcpy(&this->bounds, bounds, sizeof(struct interval));
+}
+
+/* Restricts both the valid interval and the bounds of an iterstate to the
+ * gap [LEFT, RIGHT] that its node occupies in its parent.
+ */
+void ft_iterstate_restrict(struct figtree_iterstate* this, byte_index_t left,
+                           byte_index_t right) {
+    i_restrict_range(&this->valid, left, right, false);
+    i_restrict_range(&this->bounds, left, right, false);
+}
+
+/* This is really just a header for an array of figtree_iterstates.
+ * The current position is given by the current entry of the iterstate
+ * at index DEPTH.
+ */
+struct figtree_iter {
+    int depth; // Index into following array
+    int pathdepth; // Deepest iterstate that is on the current path
+    /* If the tree has buffered writes, they are merged into the FIGs read
+     * from the tree, which are then read one ahead into TREEFIG.
+     */
+    struct ft_buffer* buffer; // NULL if there is nothing to merge
+    size_t bufpos; // next buffered entry to merge
+    struct ft_trace* trace; // that of the tree, for recording fti_seek
+    bool reverse; // from ft_read_reverse, so POS runs right to left
+    struct interval range;
+    bool hastreefig;
+    struct fig treefig;
+    /* Only leaves are compressed, so at most one node on the path, the
+     * deepest, has to be decoded into LEAF.
+     */
+    struct ft_node leaf;
+    struct figtree_iterstate states[];
+};
+
+size_t ft_read_size(struct figtree* this) {
+    return sizeof(struct figtree_iter) +
+        (sizeof(struct figtree_iterstate) * (this->root.HEIGHT + 2));
+}
+
+/* Starting from the iterstate at this->depth, whose node has not been
+ * scanned yet, descends to the first FIG that contains or follows START, and
+ * then backtracks to the iterstate that yields it.
+ */
+void _fti_descend(struct figtree_iter* this, byte_index_t start) {
+    struct figtree_iterstate* rs = &this->states[this->depth];
+    struct figtree_iterstate* ors; /* temp. pointer to change rs */
+    struct interval scratch[2];
+
+    continueouterloop:
+    while (rs->node != NULL) {
+        struct interval* previval;
+        struct interval* currival = NULL;
+        this->pathdepth = this->depth;
+        while (++rs->pos < rs->node->entries_len) {
+            previval = currival;
+            currival = _ft_range(rs->node, rs->pos, rs->base,
+                                 &scratch[rs->pos & 1]);
+            if (i_contains_val(currival, start)) {
+                goto breakouterloop;
+            } else if (i_rightOf_val(currival, start)) {
+                ors = rs;
+                rs = &this->states[++this->depth];
+                ft_iterstate_init(rs,
+                                  subtree_get(&ors->node->subtrees[ors->pos]),
+                                  &this->leaf, ors->base, &ors->valid,
+                                  &ors->bounds);
+                ft_iterstate_restrict(rs, previval == NULL ?
+                                      BYTE_INDEX_MIN : (previval->right + 1),
+                                      currival->left - 1);
+                goto continueouterloop;
+            }
+        }
+        ors = rs;
+        rs = &this->states[++this->depth];
+        ft_iterstate_init(rs, subtree_get(&ors->node->subtrees[ors->pos]),
+                          &this->leaf, ors->base, &ors->valid, &ors->bounds);
+        ft_iterstate_restrict(rs, currival == NULL ?
+                              BYTE_INDEX_MIN: (currival->right + 1),
+                              BYTE_INDEX_MAX);
+    }
+    breakouterloop:
+    while (rs->node == NULL || rs->pos == rs->node->entries_len ||
+           i_leftOf_int(&rs->valid, _ft_range(rs->node, rs->pos, rs->base,
+                                              &scratch[0]))) {
+        if (--this->depth == -1) {
+            break;
+        }
+        rs = &this->states[this->depth];
+    }
+}
+
+bool _fti_next_tree(struct figtree_iter* this, struct fig* next);
+
+/* Sets up ITERATOR, which has just been positioned at START in the tree, to
+ * merge the entries of BUFFER into what it yields.
+ */
+void _fti_merge_init(struct figtree_iter* this, struct ft_buffer* buffer,
+                     byte_index_t start, byte_index_t end) {
+    if (buffer == NULL || buffer->len == 0) {
+        this->buffer = NULL;
+        return;
+    }
+    this->buffer = buffer;
+    this->bufpos = ftb_find(buffer, start);
+    i_init(&this->range, start, end);
+    this->hastreefig = _fti_next_tree(this, &this->treefig);
+}
+
+struct figtree_iter* ft_read_init(struct figtree* this, void* storage,
+                                  size_t size, byte_index_t start,
+                                  byte_index_t end) {
+    struct figtree_iter* iterator = storage;
+    struct interval initvalid;
+    struct interval initbounds;
+    FTP_TIMER_START(t0);
+
+    ASSERT(size >= ft_read_size(this), "Iterator storage is too small");
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_READ, start, end, 0);
+    }
+    iterator->depth = 0;
+    iterator->pathdepth = 0;
+    iterator->trace = this->trace;
+    iterator->reverse = false;
+
+    i_init(&initvalid, start, end);
+    i_init(&initbounds, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    ft_iterstate_init(&iterator->states[0], &this->root, &iterator->leaf, 0,
+                      &initvalid, &initbounds);
+    _fti_descend(iterator, start);
+    _fti_merge_init(iterator, this->buffer, start, end);
+    FTP_TIMER_STOP(READ, t0);
+
+    return iterator;
+}
+
+bool ft_foreach(struct figtree* this, byte_index_t start, byte_index_t end,
+                figvisitfn_t fn, void* ctx) {
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_READ, start, end, 0);
+    }
+    ft_flush_write_buffer(this);
+    return _ft_visit(&this->root, 0, start, end, fn, ctx);
+}
+
+/* Returns an iterator over the closed interval [START, END]. */
+struct figtree_iter* ft_read(struct figtree* this,
+                             byte_index_t start, byte_index_t end) {
+    size_t size = ft_read_size(this);
+    return ft_read_init(this, mem_alloc(size), size, start, end);
+}
+
+void _fti_descend_reverse(struct figtree_iter* this, byte_index_t end);
+
+void fti_seek(struct figtree_iter* this, byte_index_t start,
+              byte_index_t end) {
+    struct figtree_iterstate* rs;
+    struct interval range;
+    int depth = this->pathdepth;
+    /* A reverse iterator descends towards END, and the child on its path is
+     * the subtree after the entry at POS rather than before it. */
+    byte_index_t target = this->reverse ? end : start;
+    int childoff = this->reverse ? 1 : 0;
+    int k, i;
+    FTP_TIMER_START(t0);
+
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_READ, start, end, 0);
+    }
+
+    /* Backtrack only until we reach a node whose subtree covers TARGET. */
+    while (depth > 0 && !i_contains_val(&this->states[depth].bounds, target)) {
+        depth--;
+    }
+
+    /* The nodes above it stay on the path, but their valid intervals must be
+     * recomputed for the new range, and iteration may have moved them past
+     * the child that is on the path.
+     */
+    i_init(&range, start, end);
+    for (k = 0; k <= depth; k++) {
+        rs = &this->states[k];
+        memcpy(&rs->valid, &rs->bounds, sizeof(struct interval));
+        i_restrict_int(&rs->valid, &range, false);
+        i = rs->pos + childoff;
+        if (k != depth && (i < 0 || i >= rs->node->subtrees_len ||
+                           subtree_get(&rs->node->subtrees[i]) !=
+                           this->states[k + 1].linked)) {
+            for (i = 0; subtree_get(&rs->node->subtrees[i]) !=
+                     this->states[k + 1].linked; i++) {
+                /* Do nothing; the loop condition does all the work. */
+            }
+            rs->pos = i - childoff;
+        }
+    }
+
+    this->depth = depth;
+    if (this->reverse) {
+        _fti_descend_reverse(this, end);
+    } else {
+        this->states[depth].pos = -1;
+        _fti_descend(this, start);
+    }
+    if (this->buffer != NULL) {
+        _fti_merge_init(this, this->buffer, start, end);
+    }
+    FTP_TIMER_STOP(READ, t0);
+}
+
+/* The mirror image of _fti_descend, for iterators that run from right to
+ * left. At each iterstate, POS is the entry to yield once the subtree below it
+ * is exhausted, so POS of -1 means the node has nothing left.
+ */
+void _fti_descend_reverse(struct figtree_iter* this, byte_index_t end) {
+    struct figtree_iterstate* rs = &this->states[this->depth];
+    struct figtree_iterstate* ors; /* temp. pointer to change rs */
+    struct interval scratch[2];
+
+    continueouterloop:
+    while (rs->node != NULL) {
+        struct interval* nextival;
+        struct interval* currival = NULL;
+        this->pathdepth = this->depth;
+        rs->pos = rs->node->entries_len;
+        while (--rs->pos >= 0) {
+            nextival = currival;
+            currival = _ft_range(rs->node, rs->pos, rs->base,
+                                 &scratch[rs->pos & 1]);
+            if (i_contains_val(currival, end)) {
+                goto breakouterloop;
+            } else if (i_leftOf_val(currival, end)) {
+                ors = rs;
+                rs = &this->states[++this->depth];
+                ft_iterstate_init(rs,
+                                  subtree_get(&ors->node->subtrees[ors->pos + 1]),
+                                  &this->leaf, ors->base, &ors->valid,
+                                  &ors->bounds);
+                ft_iterstate_restrict(rs, currival->right + 1,
+                                      nextival == NULL ?
+                                      BYTE_INDEX_MAX : (nextival->left - 1));
+                goto continueouterloop;
+            }
+        }
+        ors = rs;
+        rs = &this->states[++this->depth];
+        ft_iterstate_init(rs, subtree_get(&ors->node->subtrees[0]),
+                          &this->leaf, ors->base, &ors->valid, &ors->bounds);
+        ft_iterstate_restrict(rs, BYTE_INDEX_MIN, currival == NULL ?
+                              BYTE_INDEX_MAX : (currival->left - 1));
+    }
+    breakouterloop:
+    while (rs->node == NULL || rs->pos == -1 ||
+           i_rightOf_int(&rs->valid, _ft_range(rs->node, rs->pos, rs->base,
+                                               &scratch[0]))) {
+        if (--this->depth == -1) {
+            break;
+        }
+        rs = &this->states[this->depth];
+    }
+}
+
+struct figtree_iter* ft_read_reverse(struct figtree* this,
+                                     byte_index_t start, byte_index_t end) {
+    struct figtree_iter* iterator;
+    struct interval initvalid;
+    struct interval initbounds;
+
+    ft_flush_write_buffer(this);
+    if (this->trace != NULL) {
+        ftr_record(this->trace, FTR_READ, start, end, 0);
+    }
+    iterator = mem_alloc(ft_read_size(this));
+    iterator->depth = 0;
+    iterator->pathdepth = 0;
+    iterator->trace = this->trace;
+    iterator->reverse = true;
+    iterator->buffer = NULL;
+
+    i_init(&initvalid, start, end);
+    i_init(&initbounds, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    ft_iterstate_init(&iterator->states[0], &this->root, &iterator->leaf, 0,
+                      &initvalid, &initbounds);
+    _fti_descend_reverse(iterator, end);
+
+    return iterator;
+}
+
+/* A growable array of entries, used to assemble the input for ftn_build. */
+struct entbuf {
+    struct ft_ent* ents;
+    size_t len;
+    size_t cap;
+};
+
+void _entbuf_push(struct entbuf* this, byte_index_t left, byte_index_t right,
+                  figtree_value_t value) {
+    if (this->len == this->cap) {
+        struct ft_ent* newents;
+        this->cap = this->cap == 0 ? FT_SPLITLIMIT : (this->cap << 1);
+        newents = mem_alloc(this->cap * sizeof(struct ft_ent));
+        if (this->ents != NULL) {
+            memcpy(newents, this->ents, this->len * sizeof(struct ft_ent));
+            mem_free(this->ents);
+        }
+        this->ents = newents;
+    }
+    i_init(&this->ents[this->len].irange, left, right);
+    this->ents[this->len].value = value;
+    this->len++;
+}
+
+/* Checks the input to ft_load and converts it into entries. */
+struct ft_ent* _ft_load_ents(struct fig* figs, size_t num_figs) {
+    struct ft_ent* ents = mem_alloc(num_figs * sizeof(struct ft_ent));
+    size_t i;
+    for (i = 0; i < num_figs; i++) {
+        ASSERT(figs[i].irange.left <= figs[i].irange.right &&
+               (i == 0 || figs[i - 1].irange.right < figs[i].irange.left),
+               "FIGs passed to ft_load are not sorted and disjoint");
+        memcpy(&ents[i].irange, &figs[i].irange, sizeof(struct interval));
+        ents[i].value = figs[i].value;
+    }
+    return ents;
+}
+
+void ft_load(struct figtree* this, struct fig* figs, size_t num_figs) {
+    struct ft_ent* ents = _ft_load_ents(figs, num_figs);
+    ftn_move(&this->root, ftn_build(ents, num_figs, ftn_height_for(num_figs)));
+    this->valueindex = NULL;
+    this->buffer = NULL;
+    this->buffer_limit = 0;
+    this->trace = NULL;
+    this->lookup_cache = false;
+    _ft_new_generation(this);
+    mem_free(ents);
+}
+
+void ft_load_parallel(struct figtree* this, struct fig* figs, size_t num_figs,
+                      int num_threads) {
+    struct ft_ent* ents = _ft_load_ents(figs, num_figs);
+    ftn_move(&this->root, ftn_build_parallel(ents, num_figs,
+                                             ftn_height_for(num_figs),
+                                             num_threads));
+    this->valueindex = NULL;
+    this->buffer = NULL;
+    this->buffer_limit = 0;
+    this->trace = NULL;
+    this->lookup_cache = false;
+    _ft_new_generation(this);
+    mem_free(ents);
+}
+
+/* Same as fti_next on an iterator over the source of an overlay. Since an
+ * overlay in place has the same effect as writing every FIG from the source,
+ * that is what goes into TRACE, if it is not NULL.
+ */
+bool _ft_overlay_next(struct figtree_iter* srciter, struct fig* sfig,
+                      struct ft_trace* trace) {
+    if (!fti_next(srciter, sfig)) {
+        return false;
+    }
+    if (trace != NULL) {
+        ftr_record(trace, FTR_WRITE, sfig->irange.left, sfig->irange.right,
+                   sfig->value);
+    }
+    return true;
+}
+
+void ft_overlay(struct figtree* dst, struct figtree* src,
+                struct figtree* result) {
+    struct figtree_iter* dstiter;
+    struct figtree_iter* srciter;
+    struct entbuf merged;
+    struct ft_trace* trace = dst->trace;
+    struct fig dfig, sfig;
+    bool hasd, hass;
+
+    ASSERT(result != dst && result != src,
+           "ft_overlay result must differ from its inputs");
+
+    /* Reading DST is part of updating it, not a read to trace. */
+    dst->trace = NULL;
+    dstiter = ft_read(dst, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    dst->trace = trace;
+    srciter = ft_read(src, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    if (result != NULL) {
+        trace = NULL;
+    }
+    memset(&merged, 0x00, sizeof(merged));
+
+    /* Both iterators yield sorted, disjoint FIGs, so a single merge pass
+     * suffices. A FIG from SRC is always emitted whole; a FIG from DST is
+     * emitted only where no FIG from SRC covers it.
+     */
+    hasd = fti_next(dstiter, &dfig);
+    hass = _ft_overlay_next(srciter, &sfig, trace);
+    while (hasd) {
+        while (hass && sfig.irange.right < dfig.irange.left) {
+            _entbuf_push(&merged, sfig.irange.left, sfig.irange.right,
+                         sfig.value);
+            hass = _ft_overlay_next(srciter, &sfig, trace);
+        }
+        if (!hass || sfig.irange.left > dfig.irange.right) {
+            _entbuf_push(&merged, dfig.irange.left, dfig.irange.right,
+                         dfig.value);
+            hasd = fti_next(dstiter, &dfig);
+            continue;
+        }
+
+        /* SFIG overlaps DFIG. Keep the part of DFIG to the left of it. */
+        if (dfig.irange.left < sfig.irange.left) {
+            _entbuf_push(&merged, dfig.irange.left, sfig.irange.left - 1,
+                         dfig.value);
+        }
+        if (dfig.irange.right > sfig.irange.right) {
+            /* The rest of DFIG may still be visible past SFIG. */
+            dfig.irange.left = sfig.irange.right + 1;
+            _entbuf_push(&merged, sfig.irange.left, sfig.irange.right,
+                         sfig.value);
+            hass = _ft_overlay_next(srciter, &sfig, trace);
+        } else {
+            /* SFIG may overlap the next FIG from DST as well. */
+            hasd = fti_next(dstiter, &dfig);
+        }
+    }
+    while (hass) {
+        _entbuf_push(&merged, sfig.irange.left, sfig.irange.right, sfig.value);
+        hass = _ft_overlay_next(srciter, &sfig, trace);
+    }
+    fti_free(dstiter);
+    fti_free(srciter);
+
+    /* The iterators merged in any buffered writes, so the result has none. */
+    if (result == NULL) {
+        ftn_dealloc(&dst->root);
+        result = dst;
+        if (result->buffer != NULL) {
+            ftb_clear(result->buffer);
+        }
+    } else {
+        result->valueindex = NULL;
+        result->buffer = NULL;
+        result->buffer_limit = 0;
+        result->trace = NULL;
+        result->lookup_cache = false;
+        _ft_new_generation(result);
+    }
+    _ft_modified(result);
+    ftn_move(&result->root, ftn_build(merged.ents, merged.len,
+                                      ftn_height_for(merged.len)));
+    mem_free(merged.ents);
+
+    if (result->valueindex != NULL) {
+        fvi_free(result->valueindex);
+        result->valueindex = NULL;
+        ft_index_values(result);
+    }
+}
+
+void ft_diff(struct figtree* a, struct figtree* b, figdifffn_t fn, void* arg) {
+    struct figtree_iter* aiter;
+    struct figtree_iter* biter;
+    struct pendingdiff pending;
+    struct fig afig, bfig;
+    bool hasa, hasb;
+    byte_index_t curr = BYTE_INDEX_MIN;
+
+    /* Nothing can differ between a tree and itself. */
+    if (a == b) {
+        return;
+    }
+
+    memset(&pending, 0x00, sizeof(pending));
+    aiter = ft_read(a, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    biter = ft_read(b, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    hasa = fti_next(aiter, &afig);
+    hasb = fti_next(biter, &bfig);
+
+    /* Sweep over the bytes from left to right. Each step covers the longest
+     * run starting at CURR over which neither tree changes value.
+     */
+    while (hasa || hasb) {
+        struct fig* oldfig = NULL;
+        struct fig* newfig = NULL;
+        byte_index_t segend = BYTE_INDEX_MAX;
+
+        if (hasa) {
+            if (afig.irange.left <= curr) {
+                oldfig = &afig;
+                segend = MIN(segend, afig.irange.right);
+            } else {
+                segend = MIN(segend, afig.irange.left - 1);
+            }
+        }
+        if (hasb) {
+            if (bfig.irange.left <= curr) {
+                newfig = &bfig;
+                segend = MIN(segend, bfig.irange.right);
+            } else {
+                segend = MIN(segend, bfig.irange.left - 1);
+            }
+        }
+
+        if ((oldfig == NULL) != (newfig == NULL) ||
+            (oldfig != NULL &&
+             !FT_VALUE_EQUAL(oldfig->value, newfig->value))) {
+            _pendingdiff_add(&pending, curr, segend, oldfig, newfig, fn, arg);
+        }
+
+        if (segend == BYTE_INDEX_MAX) {
+            break;
+        }
+        curr = segend + 1;
+        if (hasa && afig.irange.right < curr) {
+            hasa = fti_next(aiter, &afig);
+        }
+        if (hasb && bfig.irange.right < curr) {
+            hasb = fti_next(biter, &bfig);
+        }
+    }
+    _pendingdiff_flush(&pending, fn, arg);
+
+    fti_free(aiter);
+    fti_free(biter);
+}
+
+void ft_dealloc(struct figtree* this) {
+    ftn_dealloc(&this->root);
+    if (this->valueindex != NULL) {
+        fvi_free(this->valueindex);
+        this->valueindex = NULL;
+    }
+    if (this->buffer != NULL) {
+        ftb_dealloc(this->buffer);
+        mem_free(this->buffer);
+        this->buffer = NULL;
+    }
+}
+
+/* Populates NEXT with the next fig (i.e. the next range of bytes and the
+ * value it corresponds to) in the tree itself, or returns false if there is
+ * no next fig.
+ */
+bool _fti_next_tree(struct figtree_iter* this, struct fig* next) {
+    struct figtree_iterstate* states = this->states;
+    struct figtree_iterstate* rs;
+    struct figtree_iterstate* ors; /* temp. pointer to change rs */
+    struct interval* entryival; // the range of the current entry
+    struct interval scratch;
+    byte_index_t entryright;
+
+    /* At the end of the iteration, we backtrack up the tree past the root since
+     * all nodes appear "invalid" given the restricted valid interval.
+     */
+    if (this->depth == -1) {
+        return false;
+    }
+    rs = &states[this->depth];
+    ASSERT (rs->pos < rs->node->entries_len,
+            "Iterator starting at end of interior node");
+    entryival = _ft_range(rs->node, rs->pos, rs->base, &scratch);
+    entryright = entryival->right;
+
+    // Populate next with what we're going to yield
+    memcpy(&next->irange, entryival, sizeof(struct interval));
+    i_restrict_int(&next->irange, &rs->valid, false);
+    next->value = rs->node->entries[rs->pos].value;
 
     /* Now that we've populated NEXT, we need to do the hard part, which is
      * figuring out whether there's something else that comes after this, while
@@ -428,7 +2208,7 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
      */
 
     /* First, descend the subtree after the rv until we reach a leaf. */
-    if (rs->valid.right <= entry->irange.right) {
+    if (rs->valid.right <= entryright) {
         /* If we've moved past the right of the valid interval, skip the
          * remaining entries.
          */
@@ -437,11 +2217,12 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
         byte_index_t leftlimit, rightlimit;
         struct ft_node* subtree;
 
-        leftlimit = entry->irange.right + 1;
+        leftlimit = entryright + 1;
         if (++rs->pos == rs->node->entries_len) {
             rightlimit = BYTE_INDEX_MAX;
         } else {
-            rightlimit = rs->node->entries[rs->pos].irange.left - 1;
+            rightlimit = _ft_range(rs->node, rs->pos, rs->base,
+                                   &scratch)->left - 1;
         }
 
         /* If the next entry in this node is adjacent to the one we just
@@ -453,10 +2234,12 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
 
             /* This is the loop where we drill down the subtree. */
             while (subtree != NULL) {
-                oldvalid = &rs->valid;
+                ors = rs;
                 rs = &states[++this->depth];
-                ft_iterstate_init(rs, subtree, oldvalid);
-                i_restrict_range(&rs->valid, leftlimit, rightlimit, false);
+                this->pathdepth = this->depth;
+                ft_iterstate_init(rs, subtree, &this->leaf, ors->base,
+                                  &ors->valid, &ors->bounds);
+                ft_iterstate_restrict(rs, leftlimit, rightlimit);
                 /* The above operation will never result in an empty valid
                  * interval because the entry that we just yielded was valid,
                  * and we already verified that the valid interval extends
@@ -466,31 +2249,33 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
 
                 /* Skip entries to the left of the valid interval. */
                 while (++rs->pos != rs->node->entries_len &&
-                       i_leftOf_int(&rs->node->entries[rs->pos].irange,
-                                    &rs->valid)) {
+                       i_leftOf_int(_ft_range(rs->node, rs->pos, rs->base,
+                                              &scratch), &rs->valid)) {
                     /* Do nothing; the loop condition does all the work. */
                 }
 
                 if (rs->pos == 0) {
                     leftlimit = BYTE_INDEX_MIN;
                 } else {
-                    leftlimit = rs->node->entries[rs->pos - 1].irange.right + 1;
+                    leftlimit = _ft_range(rs->node, rs->pos - 1, rs->base,
+                                          &scratch)->right + 1;
                 }
 
                 if (rs->pos == rs->node->entries_len) {
                     rightlimit = BYTE_INDEX_MAX;
                 } else {
+                    entryival = _ft_range(rs->node, rs->pos, rs->base,
+                                          &scratch);
                     /* If the entry overlaps partially with the interval,
                      * then we can skip the left subtree.
                      */
-                    if (i_leftOverlaps(&rs->valid,
-                                       &rs->node->entries[rs->pos].irange)) {
+                    if (i_leftOverlaps(&rs->valid, entryival)) {
                         /* rs->node->entries[rs->pos] is the next entry to
                          * yield.
                          */
                         break;
                     }
-                    rightlimit = rs->node->entries[rs->pos].irange.left - 1;
+                    rightlimit = entryival->left - 1;
                 }
                 subtree = subtree_get(&rs->node->subtrees[rs->pos]);
             }
@@ -508,10 +2293,12 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
      * node.
      */
     while (rs->pos == rs->node->entries_len ||
-           i_leftOf_int(&rs->valid, &rs->node->entries[rs->pos].irange)) {
+           i_leftOf_int(&rs->valid, _ft_range(rs->node, rs->pos, rs->base,
+                                              &scratch))) {
         /* If we backtrack up beyond the root, then we've walked past what's in
          * the tree, and there's nothing more to yield.
          */
+        FTP_COUNT(ITER_BACKTRACKS, 1);
         if (--this->depth == -1) {
             return true;
         }
@@ -522,6 +2309,213 @@ bool fti_next(struct figtree_iter* this, struct fig* next) {
     return true;
 }
 
+/* Populates NEXT with the next fig from merging the buffered writes over the
+ * FIGs in the tree, or returns false if there is no next fig.
+ */
+bool _fti_next_merged(struct figtree_iter* this, struct fig* next) {
+    struct ft_ent* bufent = NULL;
+
+    if (this->bufpos < this->buffer->len &&
+        this->buffer->ents[this->bufpos].irange.left <= this->range.right) {
+        bufent = &this->buffer->ents[this->bufpos];
+    }
+    if (bufent == NULL && !this->hastreefig) {
+        return false;
+    }
+
+    if (bufent == NULL || (this->hastreefig &&
+                           this->treefig.irange.left < bufent->irange.left)) {
+        /* The FIG from the tree comes first; yield the part of it that is
+         * not shadowed by the buffered entry.
+         */
+        memcpy(next, &this->treefig, sizeof(struct fig));
+        if (bufent != NULL && next->irange.right >= bufent->irange.left) {
+            next->irange.right = bufent->irange.left - 1;
+            this->treefig.irange.left = bufent->irange.left;
+        } else {
+            this->hastreefig = _fti_next_tree(this, &this->treefig);
+        }
+        return true;
+    }
+
+    /* The buffered entry shadows whatever the tree has under it. */
+    memcpy(&next->irange, &bufent->irange, sizeof(struct interval));
+    i_restrict_int(&next->irange, &this->range, false);
+    next->value = bufent->value;
+    this->bufpos++;
+    while (this->hastreefig &&
+           this->treefig.irange.right <= next->irange.right) {
+        this->hastreefig = _fti_next_tree(this, &this->treefig);
+    }
+    if (this->hastreefig && this->treefig.irange.left <= next->irange.right) {
+        this->treefig.irange.left = next->irange.right + 1;
+    }
+    return true;
+}
+
+bool fti_next(struct figtree_iter* this, struct fig* next) {
+    bool result;
+    FTP_TIMER_START(t0);
+    if (this->buffer != NULL) {
+        result = _fti_next_merged(this, next);
+    } else {
+        result = _fti_next_tree(this, next);
+    }
+    FTP_TIMER_STOP(NEXT, t0);
+    return result;
+}
+
+size_t fti_next_batch(struct figtree_iter* this, struct fig* out,
+                      size_t cap) {
+    struct figtree_iterstate* states = this->states;
+    struct figtree_iterstate* rs;
+    struct interval* entryival;
+    struct interval scratch[2];
+    size_t count = 0;
+
+    if (this->buffer != NULL) {
+        while (count < cap && fti_next(this, &out[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    while (count < cap && this->depth != -1) {
+        rs = &states[this->depth];
+        if (rs->node->HEIGHT == 0) {
+            /* Consecutive entries in a leaf are consecutive FIGs, so as long
+             * as the next entry is in this leaf and still valid, there is no
+             * need to go through the general step in fti_next.
+             */
+            while (count < cap && rs->pos + 1 < rs->node->entries_len &&
+                   rs->valid.right >
+                   (entryival = _ft_range(rs->node, rs->pos, rs->base,
+                                          &scratch[0]))->right &&
+                   !i_leftOf_int(&rs->valid,
+                                 _ft_range(rs->node, rs->pos + 1, rs->base,
+                                           &scratch[1]))) {
+                memcpy(&out[count].irange, entryival,
+                       sizeof(struct interval));
+                i_restrict_int(&out[count].irange, &rs->valid, false);
+                out[count].value = rs->node->entries[rs->pos].value;
+                count++;
+                rs->pos++;
+            }
+            if (count == cap) {
+                break;
+            }
+        }
+        /* This yields the last FIG in the run and finds the next one. */
+        _fti_next_tree(this, &out[count++]);
+    }
+
+    return count;
+}
+
+/* Populates PREV with the previous fig of an iterator from ft_read_reverse,
+ * or returns false if there is no previous fig. This follows fti_next step for
+ * step, with left and right exchanged.
+ */
+bool fti_prev(struct figtree_iter* this, struct fig* prev) {
+    struct figtree_iterstate* states = this->states;
+    struct figtree_iterstate* rs;
+    struct figtree_iterstate* ors; /* temp. pointer to change rs */
+    struct interval* entryival; // the range of the current entry
+    struct interval scratch;
+    byte_index_t entryleft;
+
+    if (this->depth == -1) {
+        return false;
+    }
+    rs = &states[this->depth];
+    ASSERT (rs->pos >= 0, "Iterator starting at start of interior node");
+    entryival = _ft_range(rs->node, rs->pos, rs->base, &scratch);
+    entryleft = entryival->left;
+
+    // Populate prev with what we're going to yield
+    memcpy(&prev->irange, entryival, sizeof(struct interval));
+    i_restrict_int(&prev->irange, &rs->valid, false);
+    prev->value = rs->node->entries[rs->pos].value;
+
+    /* First, descend the subtree before the entry until we reach a leaf. */
+    if (rs->valid.left >= entryleft) {
+        /* We've moved past the left of the valid interval. */
+        rs->pos = -1;
+    } else {
+        byte_index_t leftlimit, rightlimit;
+        struct ft_node* subtree;
+
+        rightlimit = entryleft - 1;
+        if (rs->pos == 0) {
+            leftlimit = BYTE_INDEX_MIN;
+        } else {
+            leftlimit = _ft_range(rs->node, rs->pos - 1, rs->base,
+                                  &scratch)->right + 1;
+        }
+        subtree = subtree_get(&rs->node->subtrees[rs->pos]);
+        rs->pos--;
+
+        if (leftlimit <= rightlimit) {
+            while (subtree != NULL) {
+                ors = rs;
+                rs = &states[++this->depth];
+                this->pathdepth = this->depth;
+                ft_iterstate_init(rs, subtree, &this->leaf, ors->base,
+                                  &ors->valid, &ors->bounds);
+                ft_iterstate_restrict(rs, leftlimit, rightlimit);
+                /* As in fti_next, this is never empty, since the valid
+                 * interval extends past the left of the entry we just
+                 * yielded into this gap.
+                 */
+
+                /* Skip entries to the right of the valid interval. */
+                rs->pos = rs->node->entries_len;
+                while (--rs->pos != -1 &&
+                       i_rightOf_int(_ft_range(rs->node, rs->pos, rs->base,
+                                               &scratch), &rs->valid)) {
+                    /* Do nothing; the loop condition does all the work. */
+                }
+
+                if (rs->pos + 1 == rs->node->entries_len) {
+                    rightlimit = BYTE_INDEX_MAX;
+                } else {
+                    rightlimit = _ft_range(rs->node, rs->pos + 1, rs->base,
+                                           &scratch)->left - 1;
+                }
+
+                if (rs->pos == -1) {
+                    leftlimit = BYTE_INDEX_MIN;
+                } else {
+                    entryival = _ft_range(rs->node, rs->pos, rs->base,
+                                          &scratch);
+                    /* If the entry overlaps partially with the interval,
+                     * then we can skip the right subtree.
+                     */
+                    if (i_rightOverlaps(&rs->valid, entryival)) {
+                        break;
+                    }
+                    leftlimit = entryival->right + 1;
+                }
+                subtree = subtree_get(&rs->node->subtrees[rs->pos + 1]);
+            }
+        }
+    }
+
+    /* Backtrack to the entry to yield next, skipping nodes that are done or
+     * whose remaining entries are all to the left of the valid interval.
+     */
+    while (rs->pos == -1 ||
+           i_rightOf_int(&rs->valid, _ft_range(rs->node, rs->pos, rs->base,
+                                               &scratch))) {
+        if (--this->depth == -1) {
+            return true;
+        }
+        rs = &states[this->depth];
+    }
+
+    return true;
+}
+
 void fti_free(struct figtree_iter* this) {
     mem_free(this);
 }
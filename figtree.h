@@ -1,13 +1,21 @@
 #ifndef _FIGTREE_H_
 #define _FIGTREE_H_
 
+#include "figtreenode.h"
 #include "interval.h"
 #include "utils.h"
 
-void ftn_free(struct ft_node* this);
-
 typedef struct figtree {
-    struct ft_node* root;
+    /* Kept inline, so that a tree of up to FT_SPLITLIMIT - 1 FIGs lives
+     * entirely in this struct, with no allocation. */
+    struct ft_node root;
+    struct ft_valueindex* valueindex; // NULL unless ft_index_values was called
+    struct ft_buffer* buffer; // NULL unless ft_set_write_buffer was called
+    size_t buffer_limit;
+    struct ft_trace* trace; // NULL unless ft_set_trace was called
+    uint64_t generation; // unique to each ft_init, ft_load or new overlay
+    uint64_t epoch; // bumped whenever the tree is modified
+    bool lookup_cache; // set by ft_set_lookup_cache
 } figtree_t;
 
 /* Initializes a Fig Tree in the specified space. */
@@ -20,11 +28,122 @@ void ft_write(struct figtree* this, byte_index_t start, byte_index_t end,
 /* Returns a pointer to the value at the specified byte LOCATION. */
 figtree_value_t* ft_lookup(struct figtree* this, byte_index_t location);
 
+/* Moves the value of every byte from FROM onwards by DELTA bytes, as when
+ * DELTA bytes are inserted at FROM (if DELTA is positive), or the -DELTA bytes
+ * before FROM are removed (if it is negative). A FIG that spans FROM is split
+ * there, and the bytes left behind are unmapped. The bytes that are moved
+ * over are erased first (see ft_erase); those that would move past
+ * BYTE_INDEX_MAX must not be mapped.
+ * Only the path to FROM is modified; everything past it is moved through
+ * offsets kept in the nodes, which are applied lazily. A reverse index (see
+ * ft_index_values) has no such offsets, though: with one, every shift also
+ * visits each value in it, and moves each of its ranges past FROM, which
+ * takes time linear in the number of FIGs in the tree. */
+void ft_shift(struct figtree* this, byte_index_t from, int64_t delta);
+
+/* Removes the mapping for the bytes in the range [START, END], splitting the
+ * FIGs that span its ends. Subtrees that lie inside the range are freed
+ * right away, and the nodes left behind are rebalanced, so the tree shrinks
+ * back down as bytes are unmapped. */
+void ft_erase(struct figtree* this, byte_index_t start, byte_index_t end);
+
+/* Packs every leaf of the tree, other than the root, into a compressed
+ * encoding that keeps each distinct value of its entries once, and a few
+ * bytes for each entry (see figtreenode.c). FIGs in the same leaf with the
+ * same value then share it, so ft_lookup may return the same pointer for
+ * them. Lookups and reads decode the compressed leaves they visit; writes,
+ * erases and shifts unpack the leaves they modify, so call this again after
+ * a batch of modifications. The buffered writes, if any, are not flushed. */
+void ft_compress_leaves(struct figtree* this);
+
+/* Puts a write buffer in front of the tree, or removes it if LIMIT is 0.
+ * While it is there, ft_write only records writes in the buffer, resolving
+ * them against each other, and applies them to the tree in sorted order once
+ * LIMIT distinct ranges are buffered. ft_lookup and ft_read (with fti_next,
+ * fti_next_batch and fti_seek) merge the buffer with the tree; all other
+ * operations on the tree flush the buffer first. */
+void ft_set_write_buffer(struct figtree* this, size_t limit);
+
+/* Applies all buffered writes to the tree. */
+void ft_flush_write_buffer(struct figtree* this);
+
+/* Records every subsequent operation on the tree in TRACE (see
+ * figtreetrace.h), or stops recording if TRACE is NULL. The FIGs already in
+ * the tree are recorded first, as writes. Writes that go through
+ * ft_write_exchange, ft_write_if (if it writes) or an overlay in place are
+ * recorded as writes. Scans with ft_foreach, each chunk of
+ * ft_foreach_parallel, and each fti_seek are recorded as reads. The caller
+ * keeps ownership of TRACE. */
+void ft_set_trace(struct figtree* this, struct ft_trace* trace);
+
+/* Turns the lookup cache on or off. While it is on, each thread remembers the
+ * last few FIGs that ft_lookup found in the tree, and answers lookups that
+ * fall inside one of them without visiting the tree. Every modification of
+ * the tree bumps its epoch, which invalidates all of them at once. Hits and
+ * misses are also counted in FTP_LOOKUP_CACHE_HITS and
+ * FTP_LOOKUP_CACHE_MISSES when profiling (see figtreeprof.h). */
+void ft_set_lookup_cache(struct figtree* this, bool enabled);
+
+/* Sets HITS and MISSES to the number of lookups on trees with the lookup
+ * cache on that the calling thread has answered from its cache, and that it
+ * had to look up in the tree. These are always counted. */
+void ft_lookup_cache_counts(uint64_t* hits, uint64_t* misses);
+
+
+/* Returns the number of bytes in the range [START, END] that correspond to
+ * some value. Runs in time logarithmic in the size of the tree. */
+uint64_t ft_count_mapped(struct figtree* this, byte_index_t start,
+                         byte_index_t end);
+
+/* Returns the number of FIGs that ft_read would yield for the range
+ * [START, END]. Runs in time logarithmic in the size of the tree. */
+uint64_t ft_count_figs(struct figtree* this, byte_index_t start,
+                       byte_index_t end);
+
+#define FT_STATS_MAX_HEIGHT 32
+
+/* The shape of a Fig Tree, as reported by ft_stats. */
+struct ft_stats {
+    int height; // height of the root; leaves have height 0
+    uint64_t nodes;
+    uint64_t nodes_per_level[FT_STATS_MAX_HEIGHT]; // indexed by height
+    uint64_t entries_per_node[FT_SPLITLIMIT]; // number of nodes with i entries
+    double fill_factor; // fraction of entry slots in use
+    uint64_t entries;
+    uint64_t live_entries; // entries that overlap their valid interval
+    uint64_t shadowed_entries; // entries that lie outside of it
+    uint64_t mapped_bytes; // same as ft_count_mapped over the whole tree
+    uint64_t buffered_ranges; // writes waiting in the write buffer
+    uint64_t allocated_bytes; // nodes below the root, value index and buffer
+    uint64_t compressed_leaves; // leaves packed by ft_compress_leaves
+};
+
+/* Populates STATS with the shape of the tree, in one traversal of it. The
+ * write buffer, if any, is not flushed, and is only counted in
+ * BUFFERED_RANGES and ALLOCATED_BYTES. */
+void ft_stats(struct figtree* this, struct ft_stats* stats);
 
 /* Returns an iterator to read over the specified range of bytes. */
 struct figtree_iter* ft_read(struct figtree* this,
                              byte_index_t start, byte_index_t end);
 
+/* Returns the number of bytes of storage that ft_read_init needs for an
+ * iterator over this tree. This only changes when the tree grows taller. */
+size_t ft_read_size(struct figtree* this);
+
+/* Same as ft_read, but builds the iterator in the SIZE bytes at STORAGE
+ * (which must be aligned like a pointer) instead of allocating it. Such an
+ * iterator must not be passed to fti_free. */
+struct figtree_iter* ft_read_init(struct figtree* this, void* storage,
+                                  size_t size, byte_index_t start,
+                                  byte_index_t end);
+
+/* Returns an iterator that reads over the specified range of bytes from END
+ * back towards START, yielding the same FIGs as ft_read in reverse order. It
+ * must be advanced with fti_prev, and freed with fti_free. */
+struct figtree_iter* ft_read_reverse(struct figtree* this,
+                                     byte_index_t start, byte_index_t end);
+
 /* Deallocates the resources for the Fig Tree in the specified space. */
 void ft_dealloc(struct figtree* this);
 
@@ -38,6 +157,111 @@ typedef struct fig {
     figtree_value_t value;
 } fig_t;
 
+/* Receives a FIG. ARG is passed through from the caller. */
+typedef void (*figfn_t)(struct fig* fig, void* arg);
+
+/* Receives a FIG, and returns false to stop the traversal that produced it.
+ * ARG is passed through from the caller. */
+typedef bool (*figvisitfn_t)(struct fig* fig, void* arg);
+
+/* Calls FN on each FIG that ft_read would yield for [START, END], in the same
+ * order, until FN returns false. The traversal is recursive and needs no
+ * iterator state, so it is cheaper than ft_read for scans. Returns false if FN
+ * stopped it early. */
+bool ft_foreach(struct figtree* this, byte_index_t start, byte_index_t end,
+                figvisitfn_t fn, void* ctx);
+
+/* Splits [START, END] into at most MAX_CHUNKS consecutive ranges, stored in
+ * CHUNKS in order, that each hold roughly the same number of FIGs. Chunks end
+ * at FIG boundaries, and are found from the per-subtree counts, descending
+ * only into the subtrees where a chunk ends. Returns the number of chunks. */
+int ft_split(struct figtree* this, byte_index_t start, byte_index_t end,
+             struct interval* chunks, int max_chunks);
+
+/* Receives a FIG from the chunk with index CHUNK, and returns false to stop
+ * scanning that chunk. ARG is passed through from the caller. */
+typedef bool (*figchunkfn_t)(struct fig* fig, int chunk, void* arg);
+
+/* Scans the NUM_CHUNKS ranges in CHUNKS (usually from ft_split) on up to
+ * NUM_THREADS threads, including the calling one, and returns when all are
+ * done. Each chunk is scanned by a single thread, which calls FN on its FIGs
+ * in order, so results kept per chunk can be combined in order afterwards.
+ * FN may be called from several threads at once. The tree must not be
+ * modified during the scan. */
+void ft_foreach_parallel(struct figtree* this, struct interval* chunks,
+                         int num_chunks, int num_threads, figchunkfn_t fn,
+                         void* arg);
+
+/* Same as ft_write, but also calls SHADOWFN, in order, on each FIG that was
+ * live in [START, END] before the write and is shadowed by it, clipped to
+ * [START, END]. This is done during the same descent as the write. While
+ * the tree has an asynchronous writer, use ft_write_exchange_async instead.
+ */
+void ft_write_exchange(struct figtree* this, byte_index_t start,
+                       byte_index_t end, figtree_value_t value,
+                       figfn_t shadowfn, void* shadowarg);
+
+/* Starts maintaining a reverse index from each value to the ranges of bytes
+ * that correspond to it, so that ft_ranges_for_value runs in time
+ * proportional to its output. Writes pay to keep the index up to date, and
+ * ft_shift then runs in linear time.
+ */
+void ft_index_values(struct figtree* this);
+
+/* Calls FN, in order, on each FIG that corresponds to VALUE. Without a
+ * reverse index (see ft_index_values), this scans the whole tree.
+ */
+void ft_ranges_for_value(struct figtree* this, figtree_value_t value,
+                         figfn_t fn, void* arg);
+
+/* Initializes a Fig Tree in the specified space, holding the NUM_FIGS FIGs
+ * in FIGS. The FIGs must be sorted and must not overlap. Runs in linear time.
+ */
+void ft_load(struct figtree* this, struct fig* figs, size_t num_figs);
+
+/* Same as ft_load, but builds the lower levels of the tree on NUM_THREADS
+ * threads (including the calling one), and then links the upper levels on
+ * the calling thread. The result has the same shape as with ft_load. */
+void ft_load_parallel(struct figtree* this, struct fig* figs, size_t num_figs,
+                      int num_threads);
+
+/* Overlays SRC onto DST, with the same result as writing every FIG in SRC
+ * into DST (so SRC wins where they overlap), in time linear in the size of
+ * both trees. If RESULT is NULL, DST is updated in place. Otherwise, RESULT is
+ * initialized with the overlay, and DST and SRC are left unchanged. RESULT
+ * must not be DST or SRC: it is initialized without freeing what it held, so
+ * pass NULL to overlay onto DST in place.
+ */
+void ft_overlay(struct figtree* dst, struct figtree* src,
+                struct figtree* result);
+
+/* Receives a range of bytes whose value differs between two Fig Trees.
+ * OLDVAL and NEWVAL point to the value in the first and second tree, or are
+ * NULL if that tree has no value for the range. ARG is passed through from
+ * the caller.
+ */
+typedef void (*figdifffn_t)(struct interval* range, figtree_value_t* oldval,
+                            figtree_value_t* newval, void* arg);
+
+/* Calls FN, in order, on each maximal range of bytes whose value in A
+ * differs from its value in B. Runs in time linear in the size of both
+ * trees, and returns immediately if A and B are the same tree.
+ */
+void ft_diff(struct figtree* a, struct figtree* b, figdifffn_t fn, void* arg);
+
+/* Sets the bytes in the range [START, END] to correspond to VALUE, but only
+ * if every one of them currently corresponds to EXPECTED; the check and the
+ * write happen in a single descent. Returns true if the write happened.
+ * Otherwise, the tree is left unchanged, and CONFLICTFN (if not NULL) is
+ * called on each maximal sub-range that does not correspond to EXPECTED, with
+ * its current value (or NULL) as OLDVAL and EXPECTED as NEWVAL. While the
+ * tree has an asynchronous writer, use ft_write_if_async instead, which is
+ * ordered with the writes queued to it.
+ */
+bool ft_write_if(struct figtree* this, byte_index_t start, byte_index_t end,
+                 figtree_value_t expected, figtree_value_t value,
+                 figdifffn_t conflictfn, void* conflictarg);
+
 /* Fig Tree Iterator
  * An iterator over a range of bytes in a Fig Tree. On each call to next(),
  * it returns a FIG describing a range of bytes and the corresponding value
@@ -52,6 +276,25 @@ typedef struct figtree_iter figiter_t;
  * false if there are no more. */
 bool fti_next(struct figtree_iter* this, struct fig* next);
 
+/* Populates OUT with up to CAP consecutive FIGs from the Fig Tree Iterator,
+ * and returns how many were populated. Consecutive FIGs within a leaf are
+ * yielded without the backtracking that fti_next does on every call. Returns
+ * 0 once there are no more FIGs. */
+size_t fti_next_batch(struct figtree_iter* this, struct fig* out,
+                      size_t cap);
+
+/* Gets the previous FIG from an iterator returned by ft_read_reverse and
+ * populates PREV with that result, or returns false if there are no more. */
+bool fti_prev(struct figtree_iter* this, struct fig* prev);
+
+/* Repositions the Fig Tree Iterator to read over the range [START, END]
+ * instead, as if it had just been returned by ft_read, or by ft_read_reverse
+ * if that is where it came from. Only the part of the path to the current
+ * position that does not cover START (END for a reverse iterator) is redone.
+ * The tree must not have been modified since the iterator was created. */
+void fti_seek(struct figtree_iter* this, byte_index_t start,
+              byte_index_t end);
+
 /* Deallocates the resources for the specified Fig Tree Iterator */
 void fti_free(struct figtree_iter* this);
 
@@ -0,0 +1,288 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "figtree.h"
+#include "figtreeasync.h"
+#include "figtreebuf.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Asynchronous Fig Tree Writer */
+
+/* The most writes that the applier thread resolves and applies at once. */
+#define FTA_BATCH 64
+
+/* A write that the applier thread does on its own, after every write queued
+ * before it and before any queued after it, on behalf of a caller that waits
+ * for its RESULT. It is either an ft_write_if or, if EXCHANGE, an
+ * ft_write_exchange.
+ */
+struct fta_sync {
+    bool exchange;
+    figtree_value_t expected;
+    figdifffn_t conflictfn;
+    void* conflictarg;
+    figfn_t shadowfn;
+    void* shadowarg;
+    bool result;
+};
+
+/* A slot in the ring. SEQ is the position of the write that the slot holds,
+ * plus one, once it is filled; the consumer sets it to the position of the
+ * write that may fill it next once it has taken the write out. SYNC is NULL
+ * for a plain write.
+ */
+struct fta_slot {
+    uint64_t seq;
+    byte_index_t start;
+    byte_index_t end;
+    figtree_value_t value;
+    struct fta_sync* sync;
+};
+
+struct figtree_async {
+    struct figtree* tree;
+    struct fta_slot* slots;
+    uint64_t mask;
+    uint64_t tail; // position of the next write to be queued
+    uint64_t head; // position of the next write to be taken out
+    uint64_t applied; // number of writes applied to the tree
+    bool sleeping; // whether the applier is waiting for writes
+    bool stopping;
+    pthread_t applier;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // signaled when writes are queued
+    pthread_cond_t done; // broadcast when writes are applied
+    pthread_rwlock_t treelock;
+};
+
+/* Takes out up to FTA_BATCH queued writes and resolves them into BUF.
+ * Returns the number taken out. A write with a SYNC is only taken out on its
+ * own, into SYNCSLOT, since it must see the writes before it applied.
+ */
+size_t _fta_drain(struct figtree_async* this, struct ft_buffer* buf,
+                  struct fta_slot* syncslot) {
+    struct fta_slot* slot;
+    size_t count = 0;
+
+    syncslot->sync = NULL;
+    while (count < FTA_BATCH) {
+        slot = &this->slots[this->head & this->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != this->head + 1 ||
+            (slot->sync != NULL && count != 0)) {
+            break;
+        }
+        if (slot->sync != NULL) {
+            memcpy(syncslot, slot, sizeof(struct fta_slot));
+        } else {
+            ftb_write(buf, slot->start, slot->end, slot->value);
+        }
+        __atomic_store_n(&slot->seq, this->head + this->mask + 1,
+                         __ATOMIC_RELEASE);
+        this->head++;
+        count++;
+        if (syncslot->sync != NULL) {
+            break;
+        }
+    }
+    return count;
+}
+
+void* _fta_run(void* arg) {
+    struct figtree_async* this = arg;
+    struct ft_buffer buf;
+    struct fta_slot syncslot;
+    struct fta_sync* sync;
+    size_t count, i;
+
+    ftb_init(&buf);
+    for (;;) {
+        count = _fta_drain(this, &buf, &syncslot);
+        if (count == 0) {
+            pthread_mutex_lock(&this->lock);
+            __atomic_store_n(&this->sleeping, true, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            /* Check again, now that producers will see that we sleep. */
+            count = _fta_drain(this, &buf, &syncslot);
+            if (count == 0 && this->stopping) {
+                pthread_mutex_unlock(&this->lock);
+                break;
+            }
+            if (count == 0) {
+                pthread_cond_wait(&this->work, &this->lock);
+            }
+            __atomic_store_n(&this->sleeping, false, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&this->lock);
+            if (count == 0) {
+                continue;
+            }
+        }
+
+        pthread_rwlock_wrlock(&this->treelock);
+        for (i = 0; i < buf.len; i++) {
+            ft_write(this->tree, buf.ents[i].irange.left,
+                     buf.ents[i].irange.right, buf.ents[i].value);
+        }
+        if ((sync = syncslot.sync) != NULL && sync->exchange) {
+            ft_write_exchange(this->tree, syncslot.start, syncslot.end,
+                              syncslot.value, sync->shadowfn,
+                              sync->shadowarg);
+        } else if (sync != NULL) {
+            sync->result = ft_write_if(this->tree, syncslot.start,
+                                       syncslot.end, sync->expected,
+                                       syncslot.value, sync->conflictfn,
+                                       sync->conflictarg);
+        }
+        pthread_rwlock_unlock(&this->treelock);
+        ftb_clear(&buf);
+
+        pthread_mutex_lock(&this->lock);
+        __atomic_store_n(&this->applied, this->applied + count,
+                         __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&this->done);
+        pthread_mutex_unlock(&this->lock);
+    }
+    ftb_dealloc(&buf);
+    return NULL;
+}
+
+struct figtree_async* fta_new(struct figtree* tree, size_t capacity) {
+    struct figtree_async* this = mem_alloc(sizeof(struct figtree_async));
+    uint64_t cap = 1, i;
+
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    this->tree = tree;
+    this->slots = mem_alloc(cap * sizeof(struct fta_slot));
+    this->mask = cap - 1;
+    for (i = 0; i < cap; i++) {
+        this->slots[i].seq = i;
+    }
+    pthread_mutex_init(&this->lock, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->done, NULL);
+    pthread_rwlock_init(&this->treelock, NULL);
+    ASSERT(pthread_create(&this->applier, NULL, _fta_run, this) == 0,
+           "Could not start the applier thread");
+    return this;
+}
+
+/* Queues a write, and returns its ticket: the number of writes that must be
+ * applied for it to be.
+ */
+uint64_t _fta_queue(struct figtree_async* this, byte_index_t start,
+                    byte_index_t end, figtree_value_t value,
+                    struct fta_sync* sync) {
+    struct fta_slot* slot;
+    uint64_t pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+
+    ASSERT(start <= end, "Writing an empty range");
+    for (;;) {
+        uint64_t seq;
+        slot = &this->slots[pos & this->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            /* The slot is free; try to claim position POS. */
+            if (__atomic_compare_exchange_n(&this->tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (seq < pos) {
+            /* The ring is full; wait for the applier to catch up. */
+            sched_yield();
+            pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->start = start;
+    slot->end = end;
+    slot->value = value;
+    slot->sync = sync;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&this->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&this->lock);
+        pthread_cond_signal(&this->work);
+        pthread_mutex_unlock(&this->lock);
+    }
+    return pos + 1;
+}
+
+void ft_write_async(struct figtree_async* this, byte_index_t start,
+                    byte_index_t end, figtree_value_t value) {
+    _fta_queue(this, start, end, value, NULL);
+}
+
+/* Waits until the first TICKET writes have been applied. */
+void _fta_wait(struct figtree_async* this, uint64_t ticket) {
+    if (__atomic_load_n(&this->applied, __ATOMIC_ACQUIRE) >= ticket) {
+        return;
+    }
+    pthread_mutex_lock(&this->lock);
+    while (this->applied < ticket) {
+        pthread_cond_wait(&this->done, &this->lock);
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+bool ft_write_if_async(struct figtree_async* this, byte_index_t start,
+                       byte_index_t end, figtree_value_t expected,
+                       figtree_value_t value, figdifffn_t conflictfn,
+                       void* conflictarg) {
+    struct fta_sync sync;
+    memset(&sync, 0x00, sizeof(sync));
+    sync.expected = expected;
+    sync.conflictfn = conflictfn;
+    sync.conflictarg = conflictarg;
+    _fta_wait(this, _fta_queue(this, start, end, value, &sync));
+    return sync.result;
+}
+
+void ft_write_exchange_async(struct figtree_async* this, byte_index_t start,
+                             byte_index_t end, figtree_value_t value,
+                             figfn_t shadowfn, void* shadowarg) {
+    struct fta_sync sync;
+    memset(&sync, 0x00, sizeof(sync));
+    sync.exchange = true;
+    sync.shadowfn = shadowfn;
+    sync.shadowarg = shadowarg;
+    _fta_wait(this, _fta_queue(this, start, end, value, &sync));
+}
+
+void ft_flush(struct figtree_async* this) {
+    _fta_wait(this, __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE));
+}
+
+struct figtree* fta_read_begin(struct figtree_async* this) {
+    /* Waiting for every write queued so far, as ft_flush does, covers those
+     * of the calling thread whichever writers it has queued to since. */
+    _fta_wait(this, __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE));
+    pthread_rwlock_rdlock(&this->treelock);
+    return this->tree;
+}
+
+void fta_read_end(struct figtree_async* this) {
+    pthread_rwlock_unlock(&this->treelock);
+}
+
+void fta_free(struct figtree_async* this) {
+    pthread_mutex_lock(&this->lock);
+    this->stopping = true;
+    pthread_cond_signal(&this->work);
+    pthread_mutex_unlock(&this->lock);
+    pthread_join(this->applier, NULL);
+
+    pthread_rwlock_destroy(&this->treelock);
+    pthread_cond_destroy(&this->done);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->lock);
+    mem_free(this->slots);
+    mem_free(this);
+}
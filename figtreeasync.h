@@ -0,0 +1,62 @@
+#ifndef _FIGTREEASYNC_H_
+#define _FIGTREEASYNC_H_
+
+#include <stddef.h>
+
+#include "figtree.h"
+#include "utils.h"
+
+/* Asynchronous Fig Tree Writer
+ * Lets any number of threads submit writes to a Fig Tree without applying
+ * them. Writes go into a bounded lock-free ring, and a dedicated applier
+ * thread drains it in batches. The writes in a batch are first resolved
+ * against each other, so that each byte is written at most once per batch.
+ *
+ * While the writer exists, the applier thread owns the tree: other threads
+ * may only read it between fta_read_begin and fta_read_end, and may only
+ * modify it through the writer. In particular, conditional and exchanging
+ * writes must go through ft_write_if_async and ft_write_exchange_async, not
+ * ft_write_if and ft_write_exchange.
+ */
+struct figtree_async;
+
+/* Starts an applier thread for TREE, with room for CAPACITY (rounded up to a
+ * power of two) pending writes. */
+struct figtree_async* fta_new(struct figtree* tree, size_t capacity);
+
+/* Queues a write with the same semantics as ft_write. Blocks only when the
+ * ring is full. */
+void ft_write_async(struct figtree_async* this, byte_index_t start,
+                    byte_index_t end, figtree_value_t value);
+
+/* Queues a write with the same semantics as ft_write_if, and waits for the
+ * applier thread to do it, after every write queued before it and before any
+ * queued after it. CONFLICTFN is called on the applier thread. Returns
+ * whether the write happened. */
+bool ft_write_if_async(struct figtree_async* this, byte_index_t start,
+                       byte_index_t end, figtree_value_t expected,
+                       figtree_value_t value, figdifffn_t conflictfn,
+                       void* conflictarg);
+
+/* Same as ft_write_if_async, but for ft_write_exchange. SHADOWFN is called
+ * on the applier thread. */
+void ft_write_exchange_async(struct figtree_async* this, byte_index_t start,
+                             byte_index_t end, figtree_value_t value,
+                             figfn_t shadowfn, void* shadowarg);
+
+/* Returns once every write queued before the call, by any thread, has been
+ * applied to the tree. */
+void ft_flush(struct figtree_async* this);
+
+/* Waits for every write queued before the call, by any thread, to be
+ * applied, and then locks the tree against the applier thread and returns
+ * it, so reads through it see those writes, including the calling thread's
+ * own. Must be paired with fta_read_end. */
+struct figtree* fta_read_begin(struct figtree_async* this);
+void fta_read_end(struct figtree_async* this);
+
+/* Applies the pending writes, stops the applier thread and frees the writer.
+ * The tree is left as it is. */
+void fta_free(struct figtree_async* this);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "figtreebuf.h"
+#include "figtreenode.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Fig Tree Write Buffer */
+
+void ftb_init(struct ft_buffer* this) {
+    memset(this, 0x00, sizeof(struct ft_buffer));
+}
+
+/* Returns the index of the first entry at or after FROM that ends at or
+ * after LOCATION.
+ */
+size_t _ftb_search_right(struct ft_buffer* this, size_t from,
+                         byte_index_t location) {
+    size_t lo = from, hi = this->len;
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if (this->ents[mid].irange.right < location) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Returns the index of the first entry at or after FROM that starts after
+ * LOCATION.
+ */
+size_t _ftb_search_left(struct ft_buffer* this, size_t from,
+                        byte_index_t location) {
+    size_t lo = from, hi = this->len;
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if (this->ents[mid].irange.left <= location) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void ftb_write(struct ft_buffer* this, byte_index_t start, byte_index_t end,
+               figtree_value_t value) {
+    struct ft_ent leftpiece, rightpiece;
+    bool keepleft, keepright;
+    size_t lo, hi, at, newlen;
+
+    ASSERT(start <= end, "Writing an empty range to a write buffer");
+
+    /* The entries in [LO, HI) overlap [START, END]. */
+    lo = _ftb_search_right(this, 0, start);
+    hi = _ftb_search_left(this, lo, end);
+    keepleft = lo < hi && this->ents[lo].irange.left < start;
+    keepright = lo < hi && this->ents[hi - 1].irange.right > end;
+    if (keepleft) {
+        leftpiece = this->ents[lo];
+        leftpiece.irange.right = start - 1;
+    }
+    if (keepright) {
+        rightpiece = this->ents[hi - 1];
+        rightpiece.irange.left = end + 1;
+    }
+
+    newlen = this->len - (hi - lo) + 1 + keepleft + keepright;
+    if (newlen > this->cap) {
+        struct ft_ent* newents;
+        this->cap = MAX(this->cap << 1, newlen);
+        newents = mem_alloc(this->cap * sizeof(struct ft_ent));
+        if (this->ents != NULL) {
+            memcpy(newents, this->ents, this->len * sizeof(struct ft_ent));
+            mem_free(this->ents);
+        }
+        this->ents = newents;
+    }
+
+    at = lo + keepleft + 1 + keepright;
+    memmove(&this->ents[at], &this->ents[hi],
+            (this->len - hi) * sizeof(struct ft_ent));
+    at = lo;
+    if (keepleft) {
+        this->ents[at++] = leftpiece;
+    }
+    i_init(&this->ents[at].irange, start, end);
+    this->ents[at++].value = value;
+    if (keepright) {
+        this->ents[at] = rightpiece;
+    }
+    this->len = newlen;
+}
+
+/* Returns the index of the first entry that ends at or after LOCATION. */
+size_t ftb_find(struct ft_buffer* this, byte_index_t location) {
+    return _ftb_search_right(this, 0, location);
+}
+
+/* Returns the entry containing LOCATION, or NULL if there is none. */
+struct ft_ent* ftb_lookup(struct ft_buffer* this, byte_index_t location) {
+    size_t i = _ftb_search_right(this, 0, location);
+    if (i == this->len || this->ents[i].irange.left > location) {
+        return NULL;
+    }
+    return &this->ents[i];
+}
+
+/* Removes the mapping for the bytes in [START, END]. */
+void ftb_erase(struct ft_buffer* this, byte_index_t start, byte_index_t end) {
+    size_t i;
+    ftb_write(this, start, end, (figtree_value_t) {0});
+    i = ftb_find(this, start);
+    memmove(&this->ents[i], &this->ents[i + 1],
+            (this->len - i - 1) * sizeof(struct ft_ent));
+    this->len--;
+}
+
+void ftb_shift(struct ft_buffer* this, byte_index_t from, int64_t delta) {
+    size_t i;
+    if (delta < 0) {
+        ftb_erase(this, from - (byte_index_t) -delta, from - 1);
+    }
+    i = ftb_find(this, from);
+    /* Split the entry that spans FROM, if any. */
+    if (i < this->len && this->ents[i].irange.left < from) {
+        ftb_write(this, from, this->ents[i].irange.right, this->ents[i].value);
+        i++;
+    }
+    for (; i < this->len; i++) {
+        this->ents[i].irange.left += (byte_index_t) delta;
+        this->ents[i].irange.right += (byte_index_t) delta;
+    }
+}
+
+void ftb_clear(struct ft_buffer* this) {
+    this->len = 0;
+}
+
+void ftb_dealloc(struct ft_buffer* this) {
+    if (this->ents != NULL) {
+        mem_free(this->ents);
+    }
+    ftb_init(this);
+}
@@ -0,0 +1,31 @@
+#ifndef _FIGTREEBUF_H_
+#define _FIGTREEBUF_H_
+
+#include <stddef.h>
+
+#include "figtreenode.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Fig Tree Write Buffer
+ * A small interval map kept as a sorted array of non-overlapping entries.
+ * Writes to it resolve overwrites the same way a Fig Tree does, so that a
+ * run of writes can be replayed into a Fig Tree as one sorted pass.
+ */
+struct ft_buffer {
+    struct ft_ent* ents;
+    size_t len;
+    size_t cap;
+};
+
+void ftb_init(struct ft_buffer* this);
+void ftb_write(struct ft_buffer* this, byte_index_t start, byte_index_t end,
+               figtree_value_t value);
+size_t ftb_find(struct ft_buffer* this, byte_index_t location);
+struct ft_ent* ftb_lookup(struct ft_buffer* this, byte_index_t location);
+void ftb_erase(struct ft_buffer* this, byte_index_t start, byte_index_t end);
+void ftb_shift(struct ft_buffer* this, byte_index_t from, int64_t delta);
+void ftb_clear(struct ft_buffer* this);
+void ftb_dealloc(struct ft_buffer* this);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "figtree.h"
+#include "figtreeflat.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Frozen Fig Tree */
+
+/* The arrays that follow the header. The first three are indexed by the
+ * position of the FIG in sorted order. The last two are the Eytzinger layout
+ * of the left bounds (1-indexed; slot 0 is unused), and the sorted position
+ * of the FIG stored at each Eytzinger slot.
+ */
+struct ftf_layout {
+    figtree_value_t* values;
+    byte_index_t* lefts;
+    byte_index_t* rights;
+    byte_index_t* eytz;
+    uint32_t* eytzrank;
+    size_t size;
+};
+
+size_t _ftf_align(size_t x) {
+    return (x + 7) & ~((size_t) 7);
+}
+
+/* Computes where each array lives in a buffer holding NUM_FIGS FIGs, and
+ * returns the size of that buffer. If THIS is NULL, only the size is computed.
+ */
+size_t _ftf_layout(struct figtree_flat* this, uint64_t num_figs,
+                   struct ftf_layout* layout) {
+    size_t n = (size_t) num_figs;
+    size_t offsets[5];
+
+    offsets[0] = _ftf_align(sizeof(struct figtree_flat));
+    offsets[1] = offsets[0] + _ftf_align(n * sizeof(figtree_value_t));
+    offsets[2] = offsets[1] + _ftf_align(n * sizeof(byte_index_t));
+    offsets[3] = offsets[2] + _ftf_align(n * sizeof(byte_index_t));
+    offsets[4] = offsets[3] + _ftf_align((n + 1) * sizeof(byte_index_t));
+    layout->size = offsets[4] + _ftf_align((n + 1) * sizeof(uint32_t));
+
+    if (this != NULL) {
+        char* base = (char*) this;
+        layout->values = (figtree_value_t*) (base + offsets[0]);
+        layout->lefts = (byte_index_t*) (base + offsets[1]);
+        layout->rights = (byte_index_t*) (base + offsets[2]);
+        layout->eytz = (byte_index_t*) (base + offsets[3]);
+        layout->eytzrank = (uint32_t*) (base + offsets[4]);
+    }
+
+    return layout->size;
+}
+
+/* Fills in the Eytzinger layout with an in-order traversal of the implicit
+ * tree rooted at slot K. Returns the next sorted position to place.
+ */
+size_t _ftf_build_eytz(struct ftf_layout* layout, size_t n, size_t k,
+                       size_t pos) {
+    if (k <= n) {
+        pos = _ftf_build_eytz(layout, n, k << 1, pos);
+        layout->eytz[k] = layout->lefts[pos];
+        layout->eytzrank[k] = (uint32_t) pos;
+        pos = _ftf_build_eytz(layout, n, (k << 1) + 1, pos + 1);
+    }
+    return pos;
+}
+
+struct figtree_flat* ft_freeze(struct figtree* tree) {
+    struct figtree_flat* this;
+    struct figtree_iter* iter;
+    struct ftf_layout layout;
+    struct fig fig;
+    uint64_t num_figs = 0;
+    size_t i;
+
+    iter = ft_read(tree, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    while (fti_next(iter, &fig)) {
+        num_figs++;
+    }
+    fti_free(iter);
+    ASSERT(num_figs < UINT32_MAX, "Too many FIGs to freeze");
+
+    _ftf_layout(NULL, num_figs, &layout);
+    this = mem_alloc(layout.size);
+    this->magic = FTF_MAGIC;
+    this->version = FTF_VERSION;
+    this->value_size = sizeof(figtree_value_t);
+    this->index_size = sizeof(byte_index_t);
+    this->num_figs = num_figs;
+    this->size = layout.size;
+    _ftf_layout(this, num_figs, &layout);
+
+    i = 0;
+    iter = ft_read(tree, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    while (fti_next(iter, &fig)) {
+        layout.lefts[i] = fig.irange.left;
+        layout.rights[i] = fig.irange.right;
+        layout.values[i] = fig.value;
+        i++;
+    }
+    fti_free(iter);
+
+    _ftf_build_eytz(&layout, (size_t) num_figs, 1, 0);
+
+    return this;
+}
+
+struct figtree_flat* ftf_open(void* buf, size_t size) {
+    struct figtree_flat* this = buf;
+    struct ftf_layout layout;
+    if (size < sizeof(struct figtree_flat) || this->magic != FTF_MAGIC ||
+        this->version != FTF_VERSION ||
+        this->value_size != sizeof(figtree_value_t) ||
+        this->index_size != sizeof(byte_index_t) || this->size != size) {
+        return NULL;
+    }
+    _ftf_layout(NULL, this->num_figs, &layout);
+    if (layout.size != size) {
+        return NULL;
+    }
+    return this;
+}
+
+size_t ftf_size(struct figtree_flat* this) {
+    return (size_t) this->size;
+}
+
+/* Returns the number of FIGs whose left bound is at most LOCATION, which is
+ * one more than the sorted position of the only FIG that may contain it.
+ */
+size_t _ftf_rank(struct figtree_flat* this, struct ftf_layout* layout,
+                 byte_index_t location) {
+    size_t n = (size_t) this->num_figs;
+    size_t k = 1;
+
+    /* Every descent takes the same number of steps for a given N, and the
+     * comparison feeds the index arithmetic instead of a branch.
+     */
+    while (k <= n) {
+        k = (k << 1) + (layout->eytz[k] <= location);
+    }
+
+    /* Undo the trailing right turns (and the final left turn) to find the
+     * first slot whose key is greater than LOCATION. If there is none, K
+     * becomes 0.
+     */
+    k >>= __builtin_ffsll(~((long long) k));
+
+    return k == 0 ? n : layout->eytzrank[k];
+}
+
+figtree_value_t* ftf_lookup(struct figtree_flat* this, byte_index_t location) {
+    struct ftf_layout layout;
+    size_t rank;
+    _ftf_layout(this, this->num_figs, &layout);
+
+    rank = _ftf_rank(this, &layout, location);
+    if (rank == 0 || layout.rights[rank - 1] < location) {
+        return NULL;
+    }
+    return &layout.values[rank - 1];
+}
+
+struct figtree_flat_iter {
+    struct figtree_flat* flat;
+    size_t pos; // sorted position of the next FIG to yield
+    struct interval range;
+};
+
+struct figtree_flat_iter* ftf_read(struct figtree_flat* this,
+                                   byte_index_t start, byte_index_t end) {
+    struct figtree_flat_iter* iterator =
+        mem_alloc(sizeof(struct figtree_flat_iter));
+    struct ftf_layout layout;
+    size_t rank;
+    _ftf_layout(this, this->num_figs, &layout);
+
+    iterator->flat = this;
+    i_init(&iterator->range, start, end);
+
+    rank = _ftf_rank(this, &layout, start);
+    if (rank != 0 && layout.rights[rank - 1] >= start) {
+        iterator->pos = rank - 1;
+    } else {
+        iterator->pos = rank;
+    }
+
+    return iterator;
+}
+
+void ftf_dealloc(struct figtree_flat* this) {
+    mem_free(this);
+}
+
+bool ftfi_next(struct figtree_flat_iter* this, struct fig* next) {
+    struct ftf_layout layout;
+    _ftf_layout(this->flat, this->flat->num_figs, &layout);
+
+    if (this->pos == this->flat->num_figs ||
+        layout.lefts[this->pos] > this->range.right) {
+        return false;
+    }
+
+    i_init(&next->irange, layout.lefts[this->pos], layout.rights[this->pos]);
+    i_restrict_int(&next->irange, &this->range, false);
+    next->value = layout.values[this->pos];
+    this->pos++;
+
+    return true;
+}
+
+void ftfi_free(struct figtree_flat_iter* this) {
+    mem_free(this);
+}
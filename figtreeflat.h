@@ -0,0 +1,66 @@
+#ifndef _FIGTREEFLAT_H_
+#define _FIGTREEFLAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "figtree.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Frozen Fig Tree
+ * A read-only snapshot of the live FIGs in a Fig Tree, stored in a single
+ * contiguous, pointer-free buffer. The buffer starts with this header and is
+ * followed by the FIG arrays, whose positions are computed from NUM_FIGS, so
+ * the buffer can be written to disk and later mmap'ed and searched in place.
+ *
+ * Lookups go through an Eytzinger-ordered copy of the left bounds, which is
+ * searched without data-dependent branches.
+ */
+struct figtree_flat {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t index_size;
+    uint64_t num_figs;
+    uint64_t size; // total size of the buffer in bytes, including the header
+};
+
+#define FTF_MAGIC 0x46544631 /* "FTF1" */
+#define FTF_VERSION 1
+
+/* Produces a frozen copy of the Fig Tree. The result is a single allocation
+ * that can be freed with ftf_dealloc, or written out as ftf_size(result)
+ * bytes. */
+struct figtree_flat* ft_freeze(struct figtree* tree);
+
+/* Interprets the SIZE bytes at BUF (for example, an mmap'ed file produced
+ * from ft_freeze) as a Frozen Fig Tree, without copying. Returns NULL if the
+ * buffer was not produced by a compatible build. */
+struct figtree_flat* ftf_open(void* buf, size_t size);
+
+/* Returns the size, in bytes, of the Frozen Fig Tree's buffer. */
+size_t ftf_size(struct figtree_flat* this);
+
+/* Returns a pointer to the value at the specified byte LOCATION, or NULL if
+ * no value is stored there. Same semantics as ft_lookup. */
+figtree_value_t* ftf_lookup(struct figtree_flat* this, byte_index_t location);
+
+/* Returns an iterator to read over the specified range of bytes. Same
+ * semantics as ft_read. */
+struct figtree_flat_iter* ftf_read(struct figtree_flat* this,
+                                   byte_index_t start, byte_index_t end);
+
+/* Deallocates a Frozen Fig Tree produced by ft_freeze. */
+void ftf_dealloc(struct figtree_flat* this);
+
+typedef struct figtree_flat_iter figflatiter_t;
+
+/* Gets the next FIG from the Frozen Fig Tree Iterator and populates NEXT with
+ * that result. Same semantics as fti_next. */
+bool ftfi_next(struct figtree_flat_iter* this, struct fig* next);
+
+/* Deallocates the resources for the specified Frozen Fig Tree Iterator */
+void ftfi_free(struct figtree_flat_iter* this);
+
+#endif
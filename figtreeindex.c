@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "figtree.h"
+#include "figtreeindex.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Fig Tree Value Index */
+
+/* The ranges that correspond to one value, sorted by their left bounds. */
+struct fvi_set {
+    bool used;
+    figtree_value_t value;
+    int ranges_len;
+    int ranges_cap;
+    struct interval* ranges;
+};
+
+/* Open-addressed hash table of sets, with linear probing. SETS_CAP is a
+ * power of two, and at most half of the slots are used.
+ */
+struct ft_valueindex {
+    size_t sets_len;
+    size_t sets_cap;
+    struct fvi_set* sets;
+};
+
+#define FVI_INITIAL_CAP 16
+
+size_t _fvi_hash(figtree_value_t value) {
+    uint64_t x = (uint64_t) value;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+struct ft_valueindex* fvi_new(void) {
+    struct ft_valueindex* this = mem_alloc(sizeof(struct ft_valueindex));
+    this->sets_cap = FVI_INITIAL_CAP;
+    this->sets = mem_alloc(this->sets_cap * sizeof(struct fvi_set));
+    return this;
+}
+
+/* Returns the slot holding VALUE, or the empty slot where it belongs. */
+struct fvi_set* _fvi_slot(struct ft_valueindex* this, figtree_value_t value) {
+    size_t mask = this->sets_cap - 1;
+    size_t i = _fvi_hash(value) & mask;
+    while (this->sets[i].used && this->sets[i].value != value) {
+        i = (i + 1) & mask;
+    }
+    return &this->sets[i];
+}
+
+void _fvi_grow(struct ft_valueindex* this) {
+    struct fvi_set* oldsets = this->sets;
+    size_t oldcap = this->sets_cap;
+    size_t i;
+
+    this->sets_cap <<= 1;
+    this->sets = mem_alloc(this->sets_cap * sizeof(struct fvi_set));
+    for (i = 0; i < oldcap; i++) {
+        if (oldsets[i].used) {
+            *_fvi_slot(this, oldsets[i].value) = oldsets[i];
+        }
+    }
+    mem_free(oldsets);
+}
+
+/* Removes the set in slot HOLE, shifting back later sets in its probe run so
+ * that lookups never stop early at the emptied slot.
+ */
+void _fvi_delete(struct ft_valueindex* this, struct fvi_set* hole) {
+    size_t mask = this->sets_cap - 1;
+    size_t i = (size_t) (hole - this->sets);
+    size_t j = i;
+
+    mem_free(this->sets[i].ranges);
+    for (;;) {
+        size_t home;
+        j = (j + 1) & mask;
+        if (!this->sets[j].used) {
+            break;
+        }
+        home = _fvi_hash(this->sets[j].value) & mask;
+        /* The set at J can move to I if I lies on its probe path. */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            this->sets[i] = this->sets[j];
+            i = j;
+        }
+    }
+    memset(&this->sets[i], 0x00, sizeof(struct fvi_set));
+    this->sets_len--;
+}
+
+/* Returns the index of the last range in SET whose left bound is at most
+ * LOCATION, or -1 if there is none.
+ */
+int _fvi_search(struct fvi_set* set, byte_index_t location) {
+    int lo = 0, hi = set->ranges_len;
+    while (lo < hi) {
+        int mid = lo + ((hi - lo) >> 1);
+        if (set->ranges[mid].left <= location) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+void _fvi_insert_at(struct fvi_set* set, int index, byte_index_t left,
+                    byte_index_t right) {
+    if (set->ranges_len == set->ranges_cap) {
+        struct interval* newranges;
+        set->ranges_cap = set->ranges_cap == 0 ? 4 : (set->ranges_cap << 1);
+        newranges = mem_alloc(set->ranges_cap * sizeof(struct interval));
+        if (set->ranges != NULL) {
+            memcpy(newranges, set->ranges,
+                   set->ranges_len * sizeof(struct interval));
+            mem_free(set->ranges);
+        }
+        set->ranges = newranges;
+    }
+    memmove(&set->ranges[index + 1], &set->ranges[index],
+            (set->ranges_len - index) * sizeof(struct interval));
+    i_init(&set->ranges[index], left, right);
+    set->ranges_len++;
+}
+
+void fvi_add(struct ft_valueindex* this, byte_index_t left,
+             byte_index_t right, figtree_value_t value) {
+    struct fvi_set* set;
+
+    if ((this->sets_len + 1) << 1 > this->sets_cap) {
+        _fvi_grow(this);
+    }
+    set = _fvi_slot(this, value);
+    if (!set->used) {
+        set->used = true;
+        set->value = value;
+        this->sets_len++;
+    }
+    _fvi_insert_at(set, _fvi_search(set, left) + 1, left, right);
+}
+
+void fvi_remove(struct ft_valueindex* this, byte_index_t left,
+                byte_index_t right, figtree_value_t value) {
+    struct fvi_set* set = _fvi_slot(this, value);
+    struct interval* found;
+    int index;
+
+    ASSERT(set->used, "Removing a value missing from the value index");
+    index = _fvi_search(set, left);
+    ASSERT(index != -1 && set->ranges[index].right >= right,
+           "Removing a range missing from the value index");
+    found = &set->ranges[index];
+
+    /* Keep whatever is left of the range on either side of [LEFT, RIGHT]. */
+    if (found->left < left && found->right > right) {
+        byte_index_t oldright = found->right;
+        found->right = left - 1;
+        _fvi_insert_at(set, index + 1, right + 1, oldright);
+    } else if (found->left < left) {
+        found->right = left - 1;
+    } else if (found->right > right) {
+        found->left = right + 1;
+    } else {
+        memmove(&set->ranges[index], &set->ranges[index + 1],
+                (set->ranges_len - index - 1) * sizeof(struct interval));
+        if (--set->ranges_len == 0) {
+            _fvi_delete(this, set);
+        }
+    }
+}
+
+/* Moves every range from FROM onwards by DELTA. Unlike the tree, the index
+ * keeps no offsets to apply lazily, so this visits every slot and moves each
+ * range past FROM. */
+void fvi_shift(struct ft_valueindex* this, byte_index_t from, int64_t delta) {
+    struct fvi_set* set;
+    size_t i;
+    int j;
+    for (i = 0; i < this->sets_cap; i++) {
+        set = &this->sets[i];
+        if (!set->used) {
+            continue;
+        }
+        j = _fvi_search(set, from);
+        if (j == -1 || set->ranges[j].left < from) {
+            j++;
+        }
+        for (; j < set->ranges_len; j++) {
+            set->ranges[j].left += (byte_index_t) delta;
+            set->ranges[j].right += (byte_index_t) delta;
+        }
+    }
+}
+
+void fvi_foreach(struct ft_valueindex* this, figtree_value_t value,
+                 figfn_t fn, void* arg) {
+    struct fvi_set* set = _fvi_slot(this, value);
+    struct fig fig;
+    int i;
+    if (!set->used) {
+        return;
+    }
+    fig.value = value;
+    for (i = 0; i < set->ranges_len; i++) {
+        memcpy(&fig.irange, &set->ranges[i], sizeof(struct interval));
+        fn(&fig, arg);
+    }
+}
+
+/* Returns the number of bytes allocated for the index. */
+size_t fvi_allocated(struct ft_valueindex* this) {
+    size_t total = sizeof(struct ft_valueindex) +
+        this->sets_cap * sizeof(struct fvi_set);
+    size_t i;
+    for (i = 0; i < this->sets_cap; i++) {
+        if (this->sets[i].used) {
+            total += this->sets[i].ranges_cap * sizeof(struct interval);
+        }
+    }
+    return total;
+}
+
+void fvi_free(struct ft_valueindex* this) {
+    size_t i;
+    for (i = 0; i < this->sets_cap; i++) {
+        if (this->sets[i].used) {
+            mem_free(this->sets[i].ranges);
+        }
+    }
+    mem_free(this->sets);
+    mem_free(this);
+}
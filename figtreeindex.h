@@ -0,0 +1,27 @@
+#ifndef _FIGTREEINDEX_H_
+#define _FIGTREEINDEX_H_
+
+#include "figtree.h"
+#include "interval.h"
+#include "utils.h"
+
+/* Fig Tree Value Index
+ * A hash table from each value stored in a Fig Tree to the sorted ranges of
+ * bytes that currently correspond to it. The Fig Tree keeps it up to date on
+ * every write, using the FIGs that the write shadows, so each range in the
+ * index matches exactly one entry in the tree.
+ */
+struct ft_valueindex;
+
+struct ft_valueindex* fvi_new(void);
+void fvi_add(struct ft_valueindex* this, byte_index_t left,
+             byte_index_t right, figtree_value_t value);
+void fvi_remove(struct ft_valueindex* this, byte_index_t left,
+                byte_index_t right, figtree_value_t value);
+void fvi_shift(struct ft_valueindex* this, byte_index_t from, int64_t delta);
+void fvi_foreach(struct ft_valueindex* this, figtree_value_t value,
+                 figfn_t fn, void* arg);
+size_t fvi_allocated(struct ft_valueindex* this);
+void fvi_free(struct ft_valueindex* this);
+
+#endif
@@ -1,8 +1,11 @@
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "figtreenode.h"
+#include "figtreeprof.h"
 #include "interval.h"
 #include "utils.h"
 
@@ -34,14 +37,20 @@ void _ftn_subtrees_add(struct ft_node* this, int index, struct ft_node* new) {
     this->subtrees_len++;
 }
 
-struct ft_node* ftn_new(int height, bool make_height) {
-    struct ft_node* this;
-    ASSERT(height >= 0, "Negative height in ftn_new");
-    this = mem_alloc(sizeof(struct ft_node));
+/* Initializes a node of the specified height in the specified space. See
+ * ftn_clear for MAKE_HEIGHT.
+ */
+void ftn_init(struct ft_node* this, int height, bool make_height) {
+    ASSERT(height >= 0, "Negative height in ftn_init");
+    memset(this, 0x00, sizeof(struct ft_node));
     this->HEIGHT = height;
 
     ftn_clear(this, make_height);
-    
+}
+
+struct ft_node* ftn_new(int height, bool make_height) {
+    struct ft_node* this = mem_alloc(sizeof(struct ft_node));
+    ftn_init(this, height, make_height);
     return this;
 }
 
@@ -58,8 +67,34 @@ void ftn_clear(struct ft_node* this, bool make_height) {
         firstchild = ftn_new(this->HEIGHT - 1, true);
     }
     this->entries_len = 0;
-    subtree_set(&this->subtrees[0], firstchild);
-    this->subtrees_len = 1;
+    if (this->compressed) {
+        /* An empty compressed leaf is just the fields before ENTRIES. */
+        this->values_len = 0;
+        this->packed_len = 0;
+    } else {
+        subtree_set(&this->subtrees[0], firstchild);
+        this->subtrees_len = 1;
+    }
+    this->subtree_bytes = 0;
+    this->subtree_figs = 0;
+    this->offset = 0;
+}
+
+void ftn_summarize(struct ft_node* this) {
+    struct ft_node* child;
+    int i;
+    this->subtree_bytes = 0;
+    this->subtree_figs = (uint64_t) this->entries_len;
+    for (i = 0; i < this->entries_len; i++) {
+        this->subtree_bytes += (uint64_t) (this->entries[i].irange.right -
+                                           this->entries[i].irange.left) + 1;
+    }
+    for (i = 0; i < this->subtrees_len; i++) {
+        if ((child = subtree_get(&this->subtrees[i])) != NULL) {
+            this->subtree_bytes += child->subtree_bytes;
+            this->subtree_figs += child->subtree_figs;
+        }
+    }
 }
 
 struct ft_node* ftn_insert(struct ft_node* this, struct ft_ent* newent,
@@ -76,6 +111,7 @@ struct ft_node* ftn_insert(struct ft_node* this, struct ft_ent* newent,
 
     if (this->entries_len == FT_SPLITLIMIT) {
         // Split the node and push the middle entry to parent
+        FTP_COUNT(SPLITS, 1);
         struct ft_node* left = ftn_new(this->HEIGHT, false);
         struct ft_node* right = ftn_new(this->HEIGHT, false);
         int i;
@@ -103,12 +139,204 @@ struct ft_node* ftn_insert(struct ft_node* this, struct ft_ent* newent,
         this->subtrees_len = 2;
         this->HEIGHT++;
 
+        ftn_summarize(left);
+        ftn_summarize(right);
+        ftn_summarize(this);
+
         return this;
     }
 
+    ftn_summarize(this);
+
     return NULL;
 }
 
+/* Returns the number of entries that a full subtree of the given HEIGHT
+ * holds, saturating at SIZE_MAX.
+ */
+size_t _ftn_capacity(int height) {
+    size_t capacity = 1;
+    int i;
+    for (i = 0; i <= height; i++) {
+        if (capacity > SIZE_MAX / FT_SPLITLIMIT) {
+            return SIZE_MAX;
+        }
+        capacity *= FT_SPLITLIMIT;
+    }
+    return capacity - 1;
+}
+
+int ftn_height_for(size_t num) {
+    int height = 0;
+    while (_ftn_capacity(height) < num) {
+        height++;
+    }
+    return height;
+}
+
+/* A subtree that ftn_build_parallel leaves to a worker thread, and the slot
+ * in its parent where it goes.
+ */
+struct buildtask {
+    struct ft_ent* ents;
+    size_t num;
+    int height;
+    struct subtree_ptr* slot;
+};
+
+/* The subtrees of height CUTOFF that ftn_build_parallel hands out. NEXT is
+ * the first task that no thread has claimed yet.
+ */
+struct buildplan {
+    int cutoff;
+    struct buildtask* tasks;
+    size_t tasks_len;
+    size_t tasks_cap;
+    size_t next;
+};
+
+void _buildplan_add(struct buildplan* this, struct ft_ent* ents, size_t num,
+                    int height, struct subtree_ptr* slot) {
+    if (this->tasks_len == this->tasks_cap) {
+        struct buildtask* newtasks;
+        this->tasks_cap = this->tasks_cap == 0 ? 16 : (this->tasks_cap << 1);
+        newtasks = mem_alloc(this->tasks_cap * sizeof(struct buildtask));
+        if (this->tasks != NULL) {
+            memcpy(newtasks, this->tasks,
+                   this->tasks_len * sizeof(struct buildtask));
+            mem_free(this->tasks);
+        }
+        this->tasks = newtasks;
+    }
+    this->tasks[this->tasks_len].ents = ents;
+    this->tasks[this->tasks_len].num = num;
+    this->tasks[this->tasks_len].height = height;
+    this->tasks[this->tasks_len].slot = slot;
+    this->tasks_len++;
+}
+
+/* Builds a subtree of the given HEIGHT out of NUM sorted, non-overlapping
+ * entries. The entries are spread as evenly as possible over the fewest
+ * children that can hold them, so every leaf ends up at the same depth.
+ *
+ * If PLAN is not NULL, the subtrees of height PLAN->cutoff are recorded as
+ * tasks instead of being built, and the nodes above them are not summarized.
+ */
+struct ft_node* _ftn_build(struct ft_ent* ents, size_t num, int height,
+                           struct buildplan* plan) {
+    struct ft_node* this;
+    size_t childcap, numchildren, perchild, extra, i;
+
+    ASSERT(num <= _ftn_capacity(height), "Too many entries in ftn_build");
+    this = ftn_new(height, false);
+
+    if (height == 0) {
+        memcpy(this->entries, ents, num * sizeof(struct ft_ent));
+        this->entries_len = (int) num;
+        this->subtrees_len = (int) num + 1;
+        ftn_summarize(this);
+        return this;
+    }
+
+    childcap = _ftn_capacity(height - 1);
+    numchildren = num / (childcap + 1) + 1;
+    perchild = (num - (numchildren - 1)) / numchildren;
+    extra = (num - (numchildren - 1)) % numchildren;
+
+    for (i = 0; i < numchildren; i++) {
+        size_t childnum = perchild + (i < extra ? 1 : 0);
+        if (plan != NULL && height - 1 == plan->cutoff) {
+            _buildplan_add(plan, ents, childnum, height - 1,
+                           &this->subtrees[i]);
+        } else {
+            subtree_set(&this->subtrees[i],
+                        _ftn_build(ents, childnum, height - 1, plan));
+        }
+        ents += childnum;
+        if (i != numchildren - 1) {
+            this->entries[i] = *ents;
+            ents++;
+        }
+    }
+    this->entries_len = (int) numchildren - 1;
+    this->subtrees_len = (int) numchildren;
+    if (plan == NULL) {
+        ftn_summarize(this);
+    }
+
+    return this;
+}
+
+struct ft_node* ftn_build(struct ft_ent* ents, size_t num, int height) {
+    return _ftn_build(ents, num, height, NULL);
+}
+
+void* _buildplan_run(void* arg) {
+    struct buildplan* this = arg;
+    struct buildtask* task;
+    size_t i;
+    while ((i = __atomic_fetch_add(&this->next, 1, __ATOMIC_RELAXED)) <
+           this->tasks_len) {
+        task = &this->tasks[i];
+        subtree_set(task->slot, ftn_build(task->ents, task->num,
+                                          task->height));
+    }
+    return NULL;
+}
+
+/* Summarizes the nodes above height CUTOFF, once the subtrees below them
+ * have been built.
+ */
+void _ftn_summarize_above(struct ft_node* this, int cutoff) {
+    int i;
+    if (this->HEIGHT == cutoff) {
+        return;
+    }
+    for (i = 0; i < this->subtrees_len; i++) {
+        _ftn_summarize_above(subtree_get(&this->subtrees[i]), cutoff);
+    }
+    ftn_summarize(this);
+}
+
+struct ft_node* ftn_build_parallel(struct ft_ent* ents, size_t num,
+                                   int height, int num_threads) {
+    struct ft_node* this;
+    struct buildplan plan;
+    pthread_t* threads;
+    int i;
+
+    if (num_threads <= 1 || height == 0) {
+        return ftn_build(ents, num, height);
+    }
+
+    /* Hand out the tallest subtrees that still give each thread a few tasks,
+     * so that uneven tasks even out.
+     */
+    memset(&plan, 0x00, sizeof(plan));
+    plan.cutoff = height - 1;
+    while (plan.cutoff > 0 && num / (_ftn_capacity(plan.cutoff) + 1) <
+           (size_t) num_threads * 4) {
+        plan.cutoff--;
+    }
+    this = _ftn_build(ents, num, height, &plan);
+
+    /* The calling thread is one of the workers. */
+    threads = mem_alloc(num_threads * sizeof(pthread_t));
+    for (i = 0; i < num_threads - 1; i++) {
+        ASSERT(pthread_create(&threads[i], NULL, _buildplan_run, &plan) == 0,
+               "Could not start a build thread");
+    }
+    _buildplan_run(&plan);
+    for (i = 0; i < num_threads - 1; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    mem_free(threads);
+    mem_free(plan.tasks);
+
+    _ftn_summarize_above(this, plan.cutoff);
+    return this;
+}
+
 /* Replaces the entries from start, inclusive, to end, exclusive, with the
  * single provided entry.
  */
@@ -137,25 +365,59 @@ void ftn_replaceEntries(struct ft_node* this, int start, int end,
 
     this->entries_len -= (end - start - 1);
     this->subtrees_len -= (end - start - 1);
+
+    ftn_summarize(this);
+}
+
+/* Applies the offset of this node to its entries, and passes it on to its
+ * children. Once the offsets of all of its ancestors have been pushed down as
+ * well, the ranges stored in this node are absolute, so that it can be
+ * modified in place.
+ */
+void ftn_pushOffset(struct ft_node* this) {
+    struct ft_node* child;
+    int i;
+    ASSERT(!this->compressed, "ftn_pushOffset on a compressed node");
+    if (this->offset == 0) {
+        return;
+    }
+    for (i = 0; i < this->entries_len; i++) {
+        this->entries[i].irange.left += (byte_index_t) this->offset;
+        this->entries[i].irange.right += (byte_index_t) this->offset;
+    }
+    for (i = 0; i < this->subtrees_len; i++) {
+        if ((child = subtree_get(&this->subtrees[i])) != NULL) {
+            child->offset += this->offset;
+        }
+    }
+    this->offset = 0;
 }
 
-void ftn_pruneTo(struct ft_node* this, struct interval* valid) {
+/* Drops the entries and subtrees of this node that lie outside VALID, and
+ * trims the entries that cross its edges. Returns true if any entry was
+ * dropped, since that moves the entries after it within the node.
+ */
+bool ftn_pruneTo(struct ft_node* this, struct interval* valid) {
     struct ft_node* true_subtree;
     struct subtree_ptr* subtree;
     struct interval* entryint;
+    int old_entries_len = this->entries_len;
     
     bool entrydel[this->entries_len];
     bool subtreedel[this->subtrees_len];
     int i = 0;
     int j;
-    
+
+    FTP_COUNT(PRUNE_CALLS, 1);
+    ftn_pushOffset(this);
     if (!valid->nonempty) {
+        FTP_COUNT(PRUNED_ENTRIES, this->entries_len);
         ftn_clear(this, true);
-        return;
+        return old_entries_len != 0;
     }
 
     if (this->entries_len == 0) {
-        return;
+        return false;
     }
 
     memset(entrydel, 0x00, this->entries_len);
@@ -244,9 +506,11 @@ void ftn_pruneTo(struct ft_node* this, struct interval* valid) {
             j++;
         }
     }
+    FTP_COUNT(PRUNED_ENTRIES, this->entries_len - j);
     this->entries_len = j;
     for (i = 0, j = 0; i < this->subtrees_len; i++) {
         if (subtreedel[i]) {
+            FTP_COUNT(PRUNED_SUBTREES, subtree_get(&this->subtrees[i]) != NULL);
             subtree_free(&this->subtrees[i]);
         } else {
             this->subtrees[j] = this->subtrees[i];
@@ -257,14 +521,381 @@ void ftn_pruneTo(struct ft_node* this, struct interval* valid) {
 
     ASSERT(this->entries_len + 1 == this->subtrees_len,
            "entries-subtree invariant violated after pruning");
+
+    ftn_summarize(this);
+    return this->entries_len != old_entries_len;
 }
 
-void ftn_free(struct ft_node* this) {
-    /* First, free all subtrees. */
+/* Prunes the whole subtree rooted at this node to VALID, assuming that only
+ * one edge of VALID (the right edge if RIGHTEDGE, else the left edge) can cut
+ * into its entries. Only the path along that edge needs to be visited.
+ */
+void ftn_pruneEdge(struct ft_node* this, struct interval* valid,
+                   bool rightedge) {
+    struct interval childvalid;
+    int childindex;
+
+    if (this == NULL) {
+        return;
+    }
+
+    ftn_pruneTo(this, valid);
+    if (!valid->nonempty || this->HEIGHT == 0) {
+        return;
+    }
+
+    memcpy(&childvalid, valid, sizeof(struct interval));
+    if (this->entries_len != 0) {
+        byte_index_t lastright =
+            this->entries[this->entries_len - 1].irange.right;
+        if (rightedge ? lastright == BYTE_INDEX_MAX :
+            this->entries[0].irange.left == BYTE_INDEX_MIN) {
+            /* There is no gap on that side, so the child must be empty. */
+            i_restrict_range(&childvalid, BYTE_INDEX_MAX, BYTE_INDEX_MIN, true);
+        } else if (rightedge) {
+            i_restrict_range(&childvalid, lastright + 1, BYTE_INDEX_MAX, true);
+        } else {
+            i_restrict_range(&childvalid, BYTE_INDEX_MIN,
+                             this->entries[0].irange.left - 1, true);
+        }
+    }
+    childindex = rightedge ? this->entries_len : 0;
+    ftn_pruneEdge(ftn_child(this, childindex), &childvalid,
+                  rightedge);
+
+    ftn_summarize(this);
+}
+
+/* Removes the last entry in the subtree rooted at this node, which must have
+ * one, and stores it in ENT. The offsets of the ancestors of this node must
+ * have been pushed down.
+ */
+void ftn_removeMax(struct ft_node* this, struct ft_ent* ent) {
+    struct ft_node* last;
+
+    ftn_pushOffset(this);
+    last = subtree_get(&this->subtrees[this->entries_len]);
+    if (last != NULL && last->subtree_figs != 0) {
+        ftn_removeMax(ftn_child(this, this->entries_len), ent);
+    } else {
+        /* The subtree to the right of the last entry is empty, so it can go
+         * along with the entry.
+         */
+        ASSERT(this->entries_len != 0, "Removing from an empty subtree");
+        *ent = this->entries[--this->entries_len];
+        subtree_free(&this->subtrees[--this->subtrees_len]);
+    }
+    ftn_summarize(this);
+}
+
+/* Moves entries between the children of this node at INDEX and INDEX + 1,
+ * through the entry between them, or merges the two children if all of their
+ * entries fit in one node, so that neither has fewer than FT_ORDER entries.
+ */
+void _ftn_balancePair(struct ft_node* this, int index) {
+    struct ft_node* left = ftn_child(this, index);
+    struct ft_node* right = ftn_child(this, index + 1);
+
+    ftn_pushOffset(left);
+    ftn_pushOffset(right);
+    if (left->entries_len + right->entries_len + 1 < FT_SPLITLIMIT) {
+        left->entries[left->entries_len++] = this->entries[index];
+        memcpy(&left->entries[left->entries_len], right->entries,
+               right->entries_len * sizeof(struct ft_ent));
+        memcpy(&left->subtrees[left->subtrees_len], right->subtrees,
+               right->subtrees_len * sizeof(struct subtree_ptr));
+        left->entries_len += right->entries_len;
+        left->subtrees_len += right->subtrees_len;
+        mem_free(right);
+
+        memmove(&this->entries[index], &this->entries[index + 1],
+                (this->entries_len - index - 1) * sizeof(struct ft_ent));
+        memmove(&this->subtrees[index + 1], &this->subtrees[index + 2],
+                (this->subtrees_len - index - 2) * sizeof(struct subtree_ptr));
+        this->entries_len--;
+        this->subtrees_len--;
+        ftn_summarize(left);
+        return;
+    }
+
+    while (left->entries_len < FT_ORDER) {
+        /* Rotate the first entry of RIGHT up, and the separator down. */
+        left->entries[left->entries_len++] = this->entries[index];
+        left->subtrees[left->subtrees_len++] = right->subtrees[0];
+        this->entries[index] = right->entries[0];
+        memmove(&right->entries[0], &right->entries[1],
+                --right->entries_len * sizeof(struct ft_ent));
+        memmove(&right->subtrees[0], &right->subtrees[1],
+                --right->subtrees_len * sizeof(struct subtree_ptr));
+    }
+    while (right->entries_len < FT_ORDER) {
+        /* Rotate the last entry of LEFT up, and the separator down. */
+        memmove(&right->entries[1], &right->entries[0],
+                right->entries_len++ * sizeof(struct ft_ent));
+        memmove(&right->subtrees[1], &right->subtrees[0],
+                right->subtrees_len++ * sizeof(struct subtree_ptr));
+        right->entries[0] = this->entries[index];
+        right->subtrees[0] = left->subtrees[--left->subtrees_len];
+        this->entries[index] = left->entries[--left->entries_len];
+    }
+    ftn_summarize(left);
+    ftn_summarize(right);
+}
+
+/* Refills the child of this node at INDEX if entries were removed from it and
+ * it has fewer than FT_ORDER left, by moving entries over from a sibling or
+ * merging it with one, and then summarizes this node. The offsets of this
+ * node and its ancestors must have been pushed down.
+ */
+void ftn_rebalanceChild(struct ft_node* this, int index) {
+    struct ft_node* child;
+
+    if (this->HEIGHT != 0 && this->entries_len != 0) {
+        child = subtree_get(&this->subtrees[index]);
+        if (child->entries_len < FT_ORDER) {
+            _ftn_balancePair(this, index < this->entries_len ? index :
+                             index - 1);
+        }
+    }
+    ftn_summarize(this);
+}
+
+/* Rebalances the nodes along one edge of the subtree rooted at this node
+ * (the right edge if RIGHTEDGE, else the left edge), bottom-up, after entries
+ * along it have been removed (see ftn_pruneEdge and ftn_removeMax).
+ */
+void ftn_rebalanceEdge(struct ft_node* this, bool rightedge) {
+    int index;
+
+    if (this == NULL || this->HEIGHT == 0) {
+        return;
+    }
+    index = rightedge ? this->entries_len : 0;
+    ftn_rebalanceEdge(subtree_get(&this->subtrees[index]), rightedge);
+    ftn_rebalanceChild(this, index);
+}
+
+/* Compressed leaves
+ *
+ * Most nodes are leaves, and a leaf spends most of its space on the ranges of
+ * its entries and on its subtree pointers, which are all NULL. A compressed
+ * leaf keeps each distinct value of its entries once, and encodes each entry
+ * as two varints and a byte: the distance of its range from the end of the
+ * previous entry (for the first entry, its left end), the length of its range
+ * minus one, and the index of its value, which is left out if the leaf has
+ * only one value. Entries in a leaf are short and close together, so most of
+ * the varints take a byte or two.
+ *
+ * Readers decode a compressed leaf into a copy with ftn_view, or find one
+ * entry in it with ftn_findPacked. Writers replace it with an uncompressed
+ * copy through ftn_child before they modify it.
+ */
+
+/* The distinct values of the entries of compressed node THIS. */
+figtree_value_t* _ftn_values(struct ft_node* this) {
+    return (figtree_value_t*) (void*) this->entries;
+}
+
+/* The encoded entries of compressed node THIS, which follow its values. */
+uint8_t* _ftn_packed(struct ft_node* this) {
+    return (uint8_t*) &_ftn_values(this)[this->values_len];
+}
+
+/* Stores X in OUT, seven bits per byte, and returns the number of bytes. */
+size_t _ftn_put_varint(uint8_t* out, byte_index_t x) {
+    size_t len = 0;
+    while (x >= 0x80) {
+        out[len++] = (uint8_t) (x | 0x80);
+        x >>= 7;
+    }
+    out[len++] = (uint8_t) x;
+    return len;
+}
+
+/* Reads a varint stored by _ftn_put_varint at *IN, and moves *IN past it. */
+byte_index_t _ftn_get_varint(uint8_t** in) {
+    byte_index_t x = 0;
+    int shift = 0;
+    while (**in & 0x80) {
+        x |= (byte_index_t) (*(*in)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    x |= (byte_index_t) *(*in)++ << shift;
+    return x;
+}
+
+/* Returns a compressed copy of this node, and frees this node, if it is a
+ * leaf that is not compressed yet. Otherwise, returns this node as is. The
+ * root of a tree is not allocated with ftn_new, so it must not be passed in.
+ */
+struct ft_node* ftn_pack(struct ft_node* this) {
+    uint8_t packed[FT_SPLITLIMIT * (5 + 5 + 1)]; // 5 bytes per varint at most
+    figtree_value_t values[FT_SPLITLIMIT];
+    uint8_t valueindex[FT_SPLITLIMIT];
+    struct ft_node* result;
+    size_t len = 0;
+    int values_len = 0;
+    int i, v;
+
+    if (this->HEIGHT != 0 || this->compressed) {
+        return this;
+    }
+    for (i = 0; i < this->entries_len; i++) {
+        for (v = 0; v < values_len &&
+             !FT_VALUE_EQUAL(values[v], this->entries[i].value); v++) {
+            /* Do nothing; the loop condition does all the work. */
+        }
+        if (v == values_len) {
+            values[values_len++] = this->entries[i].value;
+        }
+        valueindex[i] = (uint8_t) v;
+    }
+    for (i = 0; i < this->entries_len; i++) {
+        len += _ftn_put_varint(&packed[len], i == 0 ?
+                               this->entries[i].irange.left :
+                               this->entries[i].irange.left -
+                               this->entries[i - 1].irange.right - 1);
+        len += _ftn_put_varint(&packed[len], this->entries[i].irange.right -
+                               this->entries[i].irange.left);
+        if (values_len > 1) {
+            packed[len++] = valueindex[i];
+        }
+    }
+    if (len > UINT8_MAX) {
+        return this; // only with an FT_ORDER well above the default
+    }
+
+    result = mem_alloc(offsetof(struct ft_node, entries) +
+                       values_len * sizeof(figtree_value_t) + len);
+    memcpy(result, this, offsetof(struct ft_node, entries));
+    result->compressed = true;
+    result->values_len = (uint8_t) values_len;
+    result->packed_len = (uint8_t) len;
+    result->subtrees_len = 0;
+    memcpy(_ftn_values(result), values, values_len * sizeof(figtree_value_t));
+    memcpy(_ftn_packed(result), packed, len);
+    ftn_free(this);
+    return result;
+}
+
+/* Returns this node, or, if it is compressed, decodes it into SCRATCH and
+ * returns SCRATCH. The decoded copy is an ordinary leaf, but it is not linked
+ * into the tree, so it is only good for reading.
+ */
+struct ft_node* ftn_view(struct ft_node* this, struct ft_node* scratch) {
+    uint8_t* in;
+    byte_index_t left, right = 0;
+    int i;
+
+    if (this == NULL || !this->compressed) {
+        return this;
+    }
+    memcpy(scratch, this, offsetof(struct ft_node, entries));
+    scratch->compressed = false;
+    scratch->values_len = 0;
+    scratch->packed_len = 0;
+    scratch->subtrees_len = this->entries_len + 1;
+    in = _ftn_packed(this);
+    for (i = 0; i < this->entries_len; i++) {
+        left = _ftn_get_varint(&in);
+        if (i != 0) {
+            left += right + 1;
+        }
+        right = left + _ftn_get_varint(&in);
+        i_init(&scratch->entries[i].irange, left, right);
+        scratch->entries[i].value =
+            _ftn_values(this)[this->values_len > 1 ? *in++ : 0];
+        subtree_set(&scratch->subtrees[i], NULL);
+    }
+    subtree_set(&scratch->subtrees[i], NULL);
+    return scratch;
+}
+
+/* Returns an uncompressed copy of this node, and frees this node, if it is
+ * compressed. Otherwise, returns this node as is.
+ */
+struct ft_node* ftn_unpack(struct ft_node* this) {
+    struct ft_node* result;
+    if (!this->compressed) {
+        return this;
+    }
+    result = ftn_view(this, mem_alloc(sizeof(struct ft_node)));
+    mem_free(this);
+    return result;
+}
+
+/* Returns the child of this node at INDEX, after unpacking it in place if it
+ * is compressed, so that it can be modified.
+ */
+struct ft_node* ftn_child(struct ft_node* this, int index) {
+    struct ft_node* child = subtree_get(&this->subtrees[index]);
+    if (child != NULL && child->compressed) {
+        FTP_COUNT(UNPACKED_LEAVES, 1);
+        child = ftn_unpack(child);
+        subtree_set(&this->subtrees[index], child);
+    }
+    return child;
+}
+
+/* Returns a pointer to the value of the entry of compressed node THIS whose
+ * stored range contains TARGET, and stores that range in FOUND, without
+ * decoding the entries after it. Returns NULL if there is no such entry. The
+ * entries of THIS with the same value share it, and so the pointer.
+ */
+figtree_value_t* ftn_findPacked(struct ft_node* this, byte_index_t target,
+                                struct interval* found) {
+    uint8_t* in = _ftn_packed(this);
+    byte_index_t left, right = 0;
+    int i, v;
+
+    for (i = 0; i < this->entries_len; i++) {
+        left = _ftn_get_varint(&in);
+        if (i != 0) {
+            left += right + 1;
+        }
+        if (left > target) {
+            return NULL;
+        }
+        right = left + _ftn_get_varint(&in);
+        v = this->values_len > 1 ? *in++ : 0;
+        if (target <= right) {
+            i_init(found, left, right);
+            return &_ftn_values(this)[v];
+        }
+    }
+    return NULL;
+}
+
+/* Returns the number of bytes allocated for this node. */
+size_t ftn_size(struct ft_node* this) {
+    if (!this->compressed) {
+        return sizeof(struct ft_node);
+    }
+    return offsetof(struct ft_node, entries) +
+        this->values_len * sizeof(figtree_value_t) + this->packed_len;
+}
+
+/* Moves the node FROM, which was allocated with ftn_new, into the space at
+ * this node, and frees what is left of FROM. The subtrees of this node, other
+ * than FROM itself, must have been freed already.
+ */
+void ftn_move(struct ft_node* this, struct ft_node* from) {
+    ASSERT(!from->compressed, "ftn_move of a compressed node");
+    memcpy(this, from, sizeof(struct ft_node));
+    mem_free(from);
+}
+
+/* Frees all subtrees of this node, but not the node itself. */
+void ftn_dealloc(struct ft_node* this) {
     int i;
     for (i = 0; i < this->subtrees_len; i++) {
         subtree_free(&this->subtrees[i]);
     }
+}
+
+void ftn_free(struct ft_node* this) {
+    /* First, free all subtrees. */
+    ftn_dealloc(this);
 
     /* Then, free this node. */
     mem_free(this);
@@ -1,3 +1,6 @@
+#ifndef _FIGTREENODE_H_
+#define _FIGTREENODE_H_
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,13 +21,31 @@ bool fte_overlaps(struct ft_ent* this, struct ft_ent* other);
 /* Fig Tree Node */
 
 struct ft_node {
+    int HEIGHT;
     int entries_len;
-    struct ft_ent entries[FT_SPLITLIMIT];
     int subtrees_len;
+    /* A compressed node is a leaf packed by ftn_pack, which only has room
+     * for the fields up to ENTRIES. In their place, it holds the VALUES_LEN
+     * distinct values of its entries, followed by PACKED_LEN bytes that
+     * encode the entries. Its SUBTREES_LEN is 0. */
+    bool compressed;
+    uint8_t values_len;
+    uint8_t packed_len;
+    /* Summary of the subtree rooted at this node: the number of bytes that
+     * its entries cover, and the number of entries. Kept exact by pruning
+     * entries as soon as they are shadowed (see ftn_pruneEdge). */
+    uint64_t subtree_bytes;
+    uint64_t subtree_figs;
+    /* Amount by which the entries of this node and of all of its descendants
+     * have been moved by ft_shift, and that has not been pushed down into
+     * them yet. The absolute range of an entry is its stored range plus the
+     * offsets of its node and all of that node's ancestors. */
+    int64_t offset;
+    struct ft_ent entries[FT_SPLITLIMIT];
     struct subtree_ptr subtrees[FT_SPLITLIMIT + 1];
-    int HEIGHT;
 };
 
+void ftn_init(struct ft_node* this, int height, bool make_height);
 struct ft_node* ftn_new(int height, bool make_height);
 void ftn_clear(struct ft_node* this, bool make_height);
 struct ft_node* ftn_insert(struct ft_node* this, struct ft_ent* newent,
@@ -33,5 +54,27 @@ struct ft_node* ftn_insert(struct ft_node* this, struct ft_ent* newent,
 void ftn_replaceEntries(struct ft_node* this, int start, int end,
                         struct interval* newent_interval,
                         figtree_value_t newent_value);
-void ftn_pruneTo(struct ft_node* this, struct interval* valid);
+int ftn_height_for(size_t num);
+struct ft_node* ftn_build(struct ft_ent* ents, size_t num, int height);
+struct ft_node* ftn_build_parallel(struct ft_ent* ents, size_t num,
+                                   int height, int num_threads);
+void ftn_pushOffset(struct ft_node* this);
+bool ftn_pruneTo(struct ft_node* this, struct interval* valid);
+void ftn_pruneEdge(struct ft_node* this, struct interval* valid,
+                   bool rightedge);
+void ftn_summarize(struct ft_node* this);
+void ftn_removeMax(struct ft_node* this, struct ft_ent* ent);
+void ftn_rebalanceChild(struct ft_node* this, int index);
+void ftn_rebalanceEdge(struct ft_node* this, bool rightedge);
+struct ft_node* ftn_pack(struct ft_node* this);
+struct ft_node* ftn_unpack(struct ft_node* this);
+struct ft_node* ftn_view(struct ft_node* this, struct ft_node* scratch);
+struct ft_node* ftn_child(struct ft_node* this, int index);
+figtree_value_t* ftn_findPacked(struct ft_node* this, byte_index_t target,
+                                struct interval* found);
+size_t ftn_size(struct ft_node* this);
+void ftn_move(struct ft_node* this, struct ft_node* from);
+void ftn_dealloc(struct ft_node* this);
 void ftn_free(struct ft_node* this);
+
+#endif
@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "figtreeprof.h"
+#include "utils.h"
+
+/* Fig Tree Profiling */
+
+#ifdef FT_PROFILE
+
+/* One thread's counters, on the registry until the thread exits. */
+struct ftp_block {
+    struct ftp_snapshot data;
+    struct ftp_block* next;
+    struct ftp_block** prevnext; // the pointer to this block in the registry
+};
+
+static pthread_mutex_t ftp_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ftp_block* ftp_registry = NULL;
+/* The totals of the threads that have exited, so that their counts still
+ * show up in snapshots once their blocks are freed. */
+static struct ftp_snapshot ftp_retired;
+static pthread_once_t ftp_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ftp_key;
+static __thread struct ftp_block* ftp_local = NULL;
+
+/* Adds the counts in PART to TOTAL. */
+void _ftp_sum(struct ftp_snapshot* total, struct ftp_snapshot* part) {
+    uint64_t* totals = (uint64_t*) total;
+    uint64_t* parts = (uint64_t*) part;
+    size_t i;
+    for (i = 0; i < sizeof(struct ftp_snapshot) / sizeof(uint64_t); i++) {
+        totals[i] += __atomic_load_n(&parts[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Runs as a thread that has counted anything exits. Folds its counts into
+ * the retired totals, and takes its block off the registry. */
+void _ftp_retire(void* arg) {
+    struct ftp_block* block = arg;
+
+    pthread_mutex_lock(&ftp_registry_lock);
+    _ftp_sum(&ftp_retired, &block->data);
+    *block->prevnext = block->next;
+    if (block->next != NULL) {
+        block->next->prevnext = block->prevnext;
+    }
+    pthread_mutex_unlock(&ftp_registry_lock);
+    ftp_local = NULL;
+    mem_free(block);
+}
+
+void _ftp_create_key(void) {
+    ASSERT(pthread_key_create(&ftp_key, _ftp_retire) == 0,
+           "Could not create the profiling key");
+}
+
+struct ftp_block* _ftp_block(void) {
+    if (ftp_local == NULL) {
+        pthread_once(&ftp_key_once, _ftp_create_key);
+        ftp_local = mem_alloc(sizeof(struct ftp_block));
+        pthread_mutex_lock(&ftp_registry_lock);
+        ftp_local->next = ftp_registry;
+        ftp_local->prevnext = &ftp_registry;
+        if (ftp_registry != NULL) {
+            ftp_registry->prevnext = &ftp_local->next;
+        }
+        ftp_registry = ftp_local;
+        pthread_mutex_unlock(&ftp_registry_lock);
+        pthread_setspecific(ftp_key, ftp_local);
+    }
+    return ftp_local;
+}
+
+/* Only the owning thread writes to a block, so a relaxed load and store is
+ * enough, and compiles to a plain increment.
+ */
+void _ftp_add(uint64_t* slot, uint64_t n) {
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+uint64_t _ftp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void _ftp_count(enum ftp_counter counter, uint64_t n) {
+    _ftp_add(&_ftp_block()->data.counters[counter], n);
+}
+
+void _ftp_record(enum ftp_op op, uint64_t start) {
+    uint64_t elapsed = _ftp_now() - start;
+    int bucket = elapsed == 0 ? 0 : 63 - __builtin_clzll(elapsed);
+    _ftp_add(&_ftp_block()->data.latency[op][MIN(bucket,
+                                                 FTP_NUM_BUCKETS - 1)], 1);
+}
+
+void ftp_snapshot(struct ftp_snapshot* snapshot) {
+    struct ftp_block* block;
+
+    pthread_mutex_lock(&ftp_registry_lock);
+    memcpy(snapshot, &ftp_retired, sizeof(struct ftp_snapshot));
+    for (block = ftp_registry; block != NULL; block = block->next) {
+        _ftp_sum(snapshot, &block->data);
+    }
+    pthread_mutex_unlock(&ftp_registry_lock);
+}
+
+void ftp_reset(void) {
+    struct ftp_block* block;
+    uint64_t* part;
+    size_t i;
+
+    pthread_mutex_lock(&ftp_registry_lock);
+    memset(&ftp_retired, 0x00, sizeof(struct ftp_snapshot));
+    for (block = ftp_registry; block != NULL; block = block->next) {
+        part = (uint64_t*) &block->data;
+        for (i = 0; i < sizeof(struct ftp_snapshot) / sizeof(uint64_t); i++) {
+            __atomic_store_n(&part[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&ftp_registry_lock);
+}
+
+#else
+
+void ftp_snapshot(struct ftp_snapshot* snapshot) {
+    memset(snapshot, 0x00, sizeof(struct ftp_snapshot));
+}
+
+void ftp_reset(void) {
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _FIGTREEPROF_H_
+#define _FIGTREEPROF_H_
+
+#include <stdint.h>
+
+/* Fig Tree Profiling
+ * Counters and latency histograms for the hot paths of the Fig Tree. They
+ * are only collected when the library is compiled with -DFT_PROFILE (for
+ * example, with "make FT_PROFILE=1"); otherwise the hooks below compile to
+ * nothing and snapshots are all zero.
+ *
+ * Each thread updates its own copy of the counters, so the hooks do not
+ * contend. A snapshot adds up the copies of all threads, including threads
+ * that have exited.
+ */
+
+enum ftp_counter {
+    FTP_NODE_VISITS, // nodes visited by writes and lookups
+    FTP_PRUNE_CALLS, // calls to ftn_pruneTo
+    FTP_PRUNED_ENTRIES, // entries removed by ftn_pruneTo
+    FTP_PRUNED_SUBTREES, // subtrees freed by ftn_pruneTo
+    FTP_SPLITS, // nodes split by ftn_insert
+    FTP_ROOT_GROWS, // splits of the root, which add a level
+    FTP_LEFT_CONTINUATIONS, // left continuations executed by writes
+    FTP_RIGHT_CONTINUATIONS, // right continuations executed by writes
+    FTP_ITER_BACKTRACKS, // levels backtracked by fti_next
+    FTP_LOOKUP_CACHE_HITS, // ft_lookup calls answered by the lookup cache
+    FTP_LOOKUP_CACHE_MISSES, // ft_lookup calls that missed the lookup cache
+    FTP_UNPACKED_LEAVES, // compressed leaves unpacked to be modified
+    FTP_NUM_COUNTERS
+};
+
+enum ftp_op {
+    FTP_OP_WRITE,
+    FTP_OP_LOOKUP,
+    FTP_OP_READ, // creating or seeking an iterator
+    FTP_OP_NEXT,
+    FTP_NUM_OPS
+};
+
+/* Bucket i counts operations that took [2^i, 2^(i+1)) nanoseconds; bucket 0
+ * also counts those that took less than a nanosecond. */
+#define FTP_NUM_BUCKETS 40
+
+struct ftp_snapshot {
+    uint64_t counters[FTP_NUM_COUNTERS];
+    uint64_t latency[FTP_NUM_OPS][FTP_NUM_BUCKETS];
+};
+
+/* Populates SNAPSHOT with the totals over all threads. */
+void ftp_snapshot(struct ftp_snapshot* snapshot);
+
+/* Zeroes the counters and histograms of all threads. Updates made during
+ * the reset may be lost. */
+void ftp_reset(void);
+
+#ifdef FT_PROFILE
+
+uint64_t _ftp_now(void);
+void _ftp_count(enum ftp_counter counter, uint64_t n);
+void _ftp_record(enum ftp_op op, uint64_t start);
+
+#define FTP_COUNT(counter, n) _ftp_count(FTP_##counter, (n))
+#define FTP_TIMER_START(name) uint64_t name = _ftp_now()
+#define FTP_TIMER_STOP(op, name) _ftp_record(FTP_OP_##op, name)
+
+#else
+
+#define FTP_COUNT(counter, n) ((void) 0)
+#define FTP_TIMER_START(name) ((void) 0)
+#define FTP_TIMER_STOP(op, name) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "figtreetrace.h"
+#include "utils.h"
+
+/* Fig Tree Trace */
+
+#define FTR_RECORD_SIZE 24
+#define FTR_TIME_BITS 56
+#define FTR_TIME_MASK ((((uint64_t) 1) << FTR_TIME_BITS) - 1)
+
+struct ftr_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t value_size;
+};
+
+struct ft_trace {
+    FILE* out;
+    uint64_t started; // CLOCK_MONOTONIC time of ftr_open, in nanoseconds
+    pthread_mutex_t lock;
+};
+
+uint64_t _ftr_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+struct ft_trace* ftr_open(FILE* out) {
+    struct ft_trace* this = mem_alloc(sizeof(struct ft_trace));
+    struct ftr_header header;
+
+    header.magic = FTR_MAGIC;
+    header.version = FTR_VERSION;
+    header.record_size = FTR_RECORD_SIZE;
+    header.value_size = sizeof(figtree_value_t);
+    ASSERT(fwrite(&header, sizeof(header), 1, out) == 1,
+           "Could not write trace header");
+
+    this->out = out;
+    this->started = _ftr_now();
+    pthread_mutex_init(&this->lock, NULL);
+    return this;
+}
+
+void ftr_record(struct ft_trace* this, enum ftr_op op, byte_index_t start,
+                byte_index_t end, figtree_value_t value) {
+    char buf[FTR_RECORD_SIZE];
+    uint64_t timeop;
+    int64_t value64 = (int64_t) value;
+
+    pthread_mutex_lock(&this->lock);
+    /* Taking the time under the lock keeps the records in time order. */
+    timeop = ((_ftr_now() - this->started) & FTR_TIME_MASK) |
+        ((uint64_t) op << FTR_TIME_BITS);
+    memcpy(&buf[0], &timeop, 8);
+    memcpy(&buf[8], &start, 4);
+    memcpy(&buf[12], &end, 4);
+    memcpy(&buf[16], &value64, 8);
+    ASSERT(fwrite(buf, FTR_RECORD_SIZE, 1, this->out) == 1,
+           "Could not write trace record");
+    pthread_mutex_unlock(&this->lock);
+}
+
+void ftr_close(struct ft_trace* this) {
+    fflush(this->out);
+    pthread_mutex_destroy(&this->lock);
+    mem_free(this);
+}
+
+bool ftr_read_header(FILE* in) {
+    struct ftr_header header;
+    return fread(&header, sizeof(header), 1, in) == 1 &&
+        header.magic == FTR_MAGIC && header.version == FTR_VERSION &&
+        header.record_size == FTR_RECORD_SIZE &&
+        header.value_size == sizeof(figtree_value_t);
+}
+
+bool ftr_read_record(FILE* in, struct ftr_record* record) {
+    char buf[FTR_RECORD_SIZE];
+    uint64_t timeop;
+    int64_t value64;
+
+    if (fread(buf, FTR_RECORD_SIZE, 1, in) != 1) {
+        return false;
+    }
+    memcpy(&timeop, &buf[0], 8);
+    memcpy(&record->start, &buf[8], 4);
+    memcpy(&record->end, &buf[12], 4);
+    memcpy(&value64, &buf[16], 8);
+    record->time = timeop & FTR_TIME_MASK;
+    record->op = (enum ftr_op) (timeop >> FTR_TIME_BITS);
+    record->value = (figtree_value_t) value64;
+    return true;
+}
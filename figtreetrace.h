@@ -0,0 +1,67 @@
+#ifndef _FIGTREETRACE_H_
+#define _FIGTREETRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "utils.h"
+
+/* Fig Tree Trace
+ * A compact binary log of the operations done on a Fig Tree, for replaying
+ * a workload offline (see replay.c). A trace is a header followed by
+ * fixed-size records in the order the operations happened:
+ *
+ *     8 bytes  nanoseconds since the trace started, with the operation in
+ *              the top 8 bits
+ *     4 bytes  start of the range (the location, for a lookup, and the
+ *              first byte moved, for a shift)
+ *     4 bytes  end of the range
+ *     8 bytes  value written (the distance moved, for a shift, and 0 for
+ *              lookups, reads and erases)
+ *
+ * All fields are in host byte order; the magic number in the header tells a
+ * reader on a host with a different byte order to reject the trace.
+ */
+
+#define FTR_MAGIC 0x52544654 /* "FTTR" */
+#define FTR_VERSION 3
+
+enum ftr_op {
+    FTR_WRITE = 1,
+    FTR_LOOKUP = 2,
+    FTR_READ = 3,
+    FTR_SHIFT = 4,
+    FTR_ERASE = 5
+};
+
+struct ftr_record {
+    uint64_t time; // nanoseconds since the trace started
+    enum ftr_op op;
+    byte_index_t start;
+    byte_index_t end;
+    figtree_value_t value;
+};
+
+struct ft_trace;
+
+/* Starts a trace that is written to OUT, which must stay open until the
+ * trace is closed. */
+struct ft_trace* ftr_open(FILE* out);
+
+/* Appends a record for an operation that is happening now. Safe to call
+ * from several threads at once. */
+void ftr_record(struct ft_trace* this, enum ftr_op op, byte_index_t start,
+                byte_index_t end, figtree_value_t value);
+
+/* Flushes the trace to its file and frees it. The file is not closed. */
+void ftr_close(struct ft_trace* this);
+
+/* Reads the header of a trace from IN. Returns false if IN does not hold a
+ * trace that this build can read. */
+bool ftr_read_header(FILE* in);
+
+/* Reads the next record of a trace from IN into RECORD. Returns false at
+ * the end of the trace. */
+bool ftr_read_record(FILE* in, struct ftr_record* record);
+
+#endif
@@ -0,0 +1,141 @@
+/* Typed Fig Tree instantiation
+ * Not compiled on its own: a source file includes it after defining
+ * FT_TYPED_NAME and FT_TYPED_VALUE and including the header that declares
+ * the tree with FIGTREE_DECLARE (see figtreetyped.h). It compiles the whole
+ * library with figtree_value_t defined as FT_TYPED_VALUE, then wraps the
+ * result in the functions that FIGTREE_DECLARE declared.
+ */
+#ifndef FT_TYPED_NAME
+#error "Define FT_TYPED_NAME and FT_TYPED_VALUE, then include figtreetyped.c"
+#endif
+
+#include "figtree.h"
+#include "figtreetyped.h"
+
+/* The value index and the trace store values as a figtree_value_t of their
+ * own, so a typed tree goes without them: their headers are replaced with
+ * hooks that do nothing, and ft_index_values leaves the index NULL. */
+#define _FIGTREEINDEX_H_
+#define _FIGTREETRACE_H_
+
+static inline struct ft_valueindex* fvi_new(void) {
+    return NULL;
+}
+
+static inline void fvi_add(struct ft_valueindex* this, byte_index_t left,
+                           byte_index_t right, figtree_value_t value) {
+    (void) this, (void) left, (void) right, (void) value;
+}
+
+static inline void fvi_remove(struct ft_valueindex* this, byte_index_t left,
+                              byte_index_t right, figtree_value_t value) {
+    (void) this, (void) left, (void) right, (void) value;
+}
+
+static inline void fvi_shift(struct ft_valueindex* this, byte_index_t from,
+                             int64_t delta) {
+    (void) this, (void) from, (void) delta;
+}
+
+static inline void fvi_foreach(struct ft_valueindex* this,
+                               figtree_value_t value, figfn_t fn, void* arg) {
+    (void) this, (void) value, (void) fn, (void) arg;
+}
+
+static inline size_t fvi_allocated(struct ft_valueindex* this) {
+    (void) this;
+    return 0;
+}
+
+static inline void fvi_free(struct ft_valueindex* this) {
+    (void) this;
+}
+
+/* Never called, since a typed tree has no ft_set_trace; a macro, since a
+ * shift records its distance as a value. */
+#define ftr_record(...) ((void) 0)
+
+#include "utils.c"
+#include "interval.c"
+#include "figtreenode.c"
+#include "figtreebuf.c"
+#include "figtree.c"
+
+#define _FTT_CAT(name, suffix) name##suffix
+#define _FTT_NAME(name, suffix) _FTT_CAT(name, suffix)
+#define FTT(suffix) _FTT_NAME(FT_TYPED_NAME, suffix)
+
+struct FTT(_impl) {
+    struct figtree tree;
+};
+
+struct _ftt_visitor {
+    FTT(_visitfn_t) fn;
+    void* arg;
+};
+
+bool _ftt_visit(struct fig* fig, void* arg) {
+    struct _ftt_visitor* this = arg;
+    return this->fn(&fig->irange, &fig->value, this->arg);
+}
+
+void FTT(_init)(struct FT_TYPED_NAME* this) {
+    this->impl = mem_alloc(sizeof(struct FTT(_impl)));
+    ft_init(&this->impl->tree);
+}
+
+void FTT(_write)(struct FT_TYPED_NAME* this, byte_index_t start,
+                 byte_index_t end, const figtree_value_t* value) {
+    ft_write(&this->impl->tree, start, end, *value);
+}
+
+void FTT(_erase)(struct FT_TYPED_NAME* this, byte_index_t start,
+                 byte_index_t end) {
+    ft_erase(&this->impl->tree, start, end);
+}
+
+void FTT(_shift)(struct FT_TYPED_NAME* this, byte_index_t from,
+                 int64_t delta) {
+    ft_shift(&this->impl->tree, from, delta);
+}
+
+figtree_value_t* FTT(_lookup)(struct FT_TYPED_NAME* this,
+                              byte_index_t location) {
+    return ft_lookup(&this->impl->tree, location);
+}
+
+bool FTT(_foreach)(struct FT_TYPED_NAME* this, byte_index_t start,
+                   byte_index_t end, FTT(_visitfn_t) fn, void* arg) {
+    struct _ftt_visitor visit = {fn, arg};
+    return ft_foreach(&this->impl->tree, start, end, _ftt_visit, &visit);
+}
+
+/* The iterator handed out is the struct figtree_iter itself. */
+struct FTT(_iter)* FTT(_read)(struct FT_TYPED_NAME* this, byte_index_t start,
+                              byte_index_t end) {
+    return (struct FTT(_iter)*) ft_read(&this->impl->tree, start, end);
+}
+
+bool FTT(_next)(struct FTT(_iter)* this, struct FTT(_fig)* next) {
+    struct fig fig;
+    if (!fti_next((struct figtree_iter*) this, &fig)) {
+        return false;
+    }
+    next->irange = fig.irange;
+    next->value = fig.value;
+    return true;
+}
+
+void FTT(_iter_free)(struct FTT(_iter)* this) {
+    fti_free((struct figtree_iter*) this);
+}
+
+void FTT(_compress_leaves)(struct FT_TYPED_NAME* this) {
+    ft_compress_leaves(&this->impl->tree);
+}
+
+void FTT(_dealloc)(struct FT_TYPED_NAME* this) {
+    ft_dealloc(&this->impl->tree);
+    mem_free(this->impl);
+    this->impl = NULL;
+}
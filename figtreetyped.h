@@ -0,0 +1,100 @@
+#ifndef _FIGTREETYPED_H_
+#define _FIGTREETYPED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Set in the source file that instantiates a typed tree (see below), and
+ * passed on to utils.h, which must not have been included yet. */
+#ifdef FT_TYPED_VALUE
+#define FT_VALUE_TYPE FT_TYPED_VALUE
+#ifdef FT_TYPED_EQUAL
+#define FT_VALUE_EQUAL FT_TYPED_EQUAL
+#endif
+#ifdef FT_TYPED_ORDER
+#define FT_ORDER FT_TYPED_ORDER
+#endif
+#endif
+
+#include "interval.h"
+#include "utils.h"
+
+/* Typed Fig Tree
+ * A Fig Tree whose values are some VALUE_TYPE, of any size, stored inline in
+ * its entries instead of behind a figtree_value_t handle. It is the Fig Tree
+ * of figtree.c itself, compiled once more with figtree_value_t defined as
+ * VALUE_TYPE, so every copy and comparison of a value is resolved at compile
+ * time for that one type, and any number of typed trees can be linked into
+ * one program next to the plain one.
+ *
+ * A header declares the typed tree, next to its value type:
+ *
+ *     struct group { uint64_t id; uint32_t flags; uint32_t gen; };
+ *     FIGTREE_DECLARE(grouptree, struct group);
+ *
+ * and one source file of its own, named after the tree, instantiates it:
+ *
+ *     #define FT_TYPED_NAME grouptree
+ *     #define FT_TYPED_VALUE struct group
+ *     #define FT_TYPED_EQUAL(a, b) ((a).id == (b).id && (a).gen == (b).gen)
+ *     #define FT_TYPED_ORDER 4
+ *     #include "grouptree.h"
+ *     #include "figtreetyped.c"
+ *
+ * FT_TYPED_EQUAL defaults to ==, so it is needed for structs, and
+ * FT_TYPED_ORDER defaults to FT_ORDER. The definitions must come before any
+ * other include, since figtreetyped.h passes them on to utils.h. The object
+ * file holds a whole copy of the library, so all of its symbols other than
+ * the tree's own must be made local before linking (see the Makefile):
+ *
+ *     objcopy -w -G 'grouptree_*' grouptree.o
+ *
+ * Then, for NAME:
+ *
+ *     struct NAME                  the tree; it owns a struct figtree
+ *     struct NAME_fig              struct interval irange and
+ *                                  VALUE_TYPE value, as in struct fig
+ *     struct NAME_iter             an iterator, as returned by ft_read
+ *     NAME_visitfn_t               bool (*)(struct interval* range,
+ *                                           VALUE_TYPE* value, void* arg)
+ *
+ * and NAME_init, NAME_write, NAME_erase, NAME_shift, NAME_lookup,
+ * NAME_foreach, NAME_read, NAME_next, NAME_iter_free, NAME_compress_leaves
+ * and NAME_dealloc behave as their ft_ and fti_ counterparts, except that
+ * NAME_write takes its value by pointer. A typed tree has no value index and
+ * no trace, since both store values as a figtree_value_t.
+ */
+
+#define FIGTREE_DECLARE(name, value_type)                                     \
+    struct name##_impl;                                                       \
+    struct name##_iter;                                                       \
+                                                                              \
+    struct name {                                                             \
+        struct name##_impl* impl;                                             \
+    };                                                                        \
+                                                                              \
+    struct name##_fig {                                                       \
+        struct interval irange;                                               \
+        value_type value;                                                     \
+    };                                                                        \
+                                                                              \
+    typedef bool (*name##_visitfn_t)(struct interval* range,                  \
+                                     value_type* value, void* arg);           \
+                                                                              \
+    void name##_init(struct name* this);                                      \
+    void name##_write(struct name* this, byte_index_t start,                  \
+                      byte_index_t end, const value_type* value);             \
+    void name##_erase(struct name* this, byte_index_t start,                  \
+                      byte_index_t end);                                      \
+    void name##_shift(struct name* this, byte_index_t from, int64_t delta);   \
+    value_type* name##_lookup(struct name* this, byte_index_t location);      \
+    bool name##_foreach(struct name* this, byte_index_t start,                \
+                        byte_index_t end, name##_visitfn_t fn, void* arg);    \
+    struct name##_iter* name##_read(struct name* this, byte_index_t start,    \
+                                    byte_index_t end);                        \
+    bool name##_next(struct name##_iter* this, struct name##_fig* next);      \
+    void name##_iter_free(struct name##_iter* this);                          \
+    void name##_compress_leaves(struct name* this);                           \
+    void name##_dealloc(struct name* this)
+
+#endif
@@ -2,10 +2,16 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "figtree.h"
+#include "figtreeasync.h"
+#include "figtreeflat.h"
 #include "figtreenode.h"
+#include "figtreeprof.h"
+#include "figtreetrace.h"
 #include "interval.h"
+#include "typedtrees.h"
 
 #define BYTE_INDEX_BITS 11
 #define MAX_FILE_SIZE (1 << BYTE_INDEX_BITS)
@@ -21,6 +27,39 @@
 
 #define MAGIC 0xb96904ab6ff9f2f5
 
+/* Writes for the feature checks use only a few values, so that neighbouring
+ * FIGs often share one. */
+#define CHECK_VALUE_MASK 0x7
+#define CHECK_WRITES 0x200
+
+/* The operations of test_edits other than writes, each one in
+ * OP_MASK + 1 of them. */
+#define OP_MASK 0x7
+#define OP_SHIFT 0
+#define OP_ERASE 1
+#define OP_COMPRESS 2
+
+/* Does to FILE what ft_shift does to a tree, and drops what moves past the
+ * end of the file. */
+void shift_file(figtree_value_t* file, byte_index_t from, int64_t delta) {
+    figtree_value_t old[MAX_FILE_SIZE];
+    int64_t j;
+
+    memcpy(old, file, sizeof(old));
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        file[j] = MAGIC;
+    }
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        if (j < from) {
+            if (j < from + delta) {
+                file[j] = old[j];
+            }
+        } else if (j + delta < MAX_FILE_SIZE) {
+            file[j + delta] = old[j];
+        }
+    }
+}
+
 unsigned int test_figtree(unsigned int seed, int threadid) {
     figtree_t ft;
     int i;
@@ -37,7 +76,7 @@ unsigned int test_figtree(unsigned int seed, int threadid) {
     while (i < NUM_ITERATIONS) {
         if (((++i) & PRINT_FREQ_MASK) == 0) {
             printf("Thread %d: iteration 0x%x (%d) [height = %d]\n", threadid,
-                   i, i, ft.root->HEIGHT);
+                   i, i, ft.root.HEIGHT);
         }
         byte_index_t start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
         byte_index_t end = start +
@@ -125,6 +164,1737 @@ unsigned int test_figtree(unsigned int seed, int threadid) {
     return seed;
 }
 
+/* Makes NUM random writes to both FT and FILE, which must start out with
+ * the same contents. */
+void random_writes(figtree_t* ft, figtree_value_t* file, unsigned int* seed,
+                   int num) {
+    byte_index_t start, end, j;
+    figtree_value_t value;
+    int i;
+
+    for (i = 0; i < num; i++) {
+        start = (byte_index_t) (rand_r(seed) & BYTE_INDEX_MASK);
+        end = start + (byte_index_t) (rand_r(seed) & MAX_WRITE_MASK);
+        value = (figtree_value_t) (rand_r(seed) & CHECK_VALUE_MASK);
+        if (end >= MAX_FILE_SIZE) {
+            end = MAX_FILE_SIZE - 1;
+        }
+        ft_write(ft, start, end, value);
+        for (j = start; j <= end; j++) {
+            file[j] = value;
+        }
+    }
+}
+
+/* Checks the FIGs yielded for the whole file, in order, against FILE.
+ * Returns the index of the first byte past the FIGs checked so far, or
+ * MAX_FILE_SIZE + 1 once a mismatch has been reported. */
+byte_index_t check_fig(struct fig* fig, figtree_value_t* file, byte_index_t j,
+                       const char* what) {
+    if (j > MAX_FILE_SIZE) {
+        return j;
+    }
+    if (fig->irange.left < j || fig->irange.left > fig->irange.right ||
+        fig->irange.right >= MAX_FILE_SIZE) {
+        fprintf(stderr, "[ERROR] %s: invalid fig [%lu, %lu]\n", what,
+                (long unsigned int) fig->irange.left,
+                (long unsigned int) fig->irange.right);
+        return MAX_FILE_SIZE + 1;
+    }
+    for (; j <= fig->irange.right; j++) {
+        if (file[j] != (j < fig->irange.left ? (figtree_value_t) MAGIC :
+                        fig->value)) {
+            fprintf(stderr, "[ERROR] %s: byte %lu is not 0x%lx\n", what,
+                    (long unsigned int) j, (long unsigned int) file[j]);
+            return MAX_FILE_SIZE + 1;
+        }
+    }
+    return j;
+}
+
+/* Checks the last FIG passed to check_fig, and reports whether all of them
+ * matched FILE. */
+bool check_end(figtree_value_t* file, byte_index_t j, const char* what) {
+    if (j > MAX_FILE_SIZE) {
+        return false;
+    }
+    for (; j < MAX_FILE_SIZE; j++) {
+        if (file[j] != (figtree_value_t) MAGIC) {
+            fprintf(stderr, "[ERROR] %s: byte %lu is not 0x%lx (no fig)\n",
+                    what, (long unsigned int) j, (long unsigned int) file[j]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Checks that lookups and a full read of FT match FILE. */
+bool check_contents(figtree_t* ft, figtree_value_t* file, const char* what) {
+    figiter_t* figiter;
+    fig_t fig;
+    figtree_value_t* res;
+    byte_index_t j;
+
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        res = ft_lookup(ft, j);
+        if ((res == NULL ? (figtree_value_t) MAGIC : *res) != file[j]) {
+            fprintf(stderr, "[ERROR] %s: lookup of byte %lu is wrong\n", what,
+                    (long unsigned int) j);
+            return false;
+        }
+    }
+    figiter = ft_read(ft, 0, BYTE_INDEX_MAX);
+    j = 0;
+    while (fti_next(figiter, &fig)) {
+        j = check_fig(&fig, file, j, what);
+    }
+    fti_free(figiter);
+    return check_end(file, j, what);
+}
+
+/* Starts a reference file with nothing mapped, and an empty tree. */
+void init_file(figtree_t* ft, figtree_value_t* file) {
+    byte_index_t j;
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        file[j] = MAGIC;
+    }
+    ft_init(ft);
+}
+
+/* The same stress test as test_figtree, but with shifts, erases and leaf
+ * compressions among the writes, and with a single iterator repositioned
+ * with fti_seek for every range. It runs on a seed of its own, so that
+ * test_figtree makes the same writes for a given seed as it always has. */
+unsigned int test_edits(unsigned int seed, int threadid) {
+    figtree_t ft;
+    int i, op;
+    int64_t delta;
+    struct ft_stats before, after;
+    byte_index_t start, end, j;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figtree_value_t value;
+    void* iterbuf;
+    size_t iterbuf_size;
+    figiter_t* figiter;
+    fig_t fig;
+
+    init_file(&ft, file);
+    i = 0;
+    while (i < NUM_ITERATIONS) {
+        if (((++i) & PRINT_FREQ_MASK) == 0) {
+            printf("Thread %d: edit iteration 0x%x (%d) [height = %d]\n",
+                   threadid, i, i, ft.root.HEIGHT);
+        }
+        start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        end = start + (byte_index_t) (rand_r(&seed) & MAX_WRITE_MASK);
+        value = (figtree_value_t) rand_r(&seed);
+        if (end >= MAX_FILE_SIZE) {
+            end = MAX_FILE_SIZE - 1;
+        }
+        op = rand_r(&seed) & OP_MASK;
+        if (op == OP_SHIFT) {
+            /* Move everything from START on by up to half a write either
+             * way, and drop what moves past the end of the file. */
+            delta = (int64_t) (end - start) - MAX_WRITE_MASK / 2;
+            if (-delta > (int64_t) start) {
+                delta = -(int64_t) start;
+            }
+            ft_shift(&ft, start, delta);
+            ft_erase(&ft, MAX_FILE_SIZE, BYTE_INDEX_MAX);
+            shift_file(file, start, delta);
+        } else if (op == OP_ERASE) {
+            /* Erase up to eight writes' worth, so that whole subtrees go. */
+            end = MIN(start + (end - start) * 8, MAX_FILE_SIZE - 1);
+            ft_erase(&ft, start, end);
+            for (j = start; j <= end; j++) {
+                file[j] = MAGIC;
+            }
+        } else if (op == OP_COMPRESS) {
+            /* The edits that follow unpack the leaves that they modify. */
+            ft_compress_leaves(&ft);
+        } else {
+            ft_write(&ft, start, end, value);
+            for (j = start; j <= end; j++) {
+                file[j] = value;
+            }
+        }
+
+        if (!check_contents(&ft, file, "edits")) {
+            goto done;
+        }
+        iterbuf_size = ft_read_size(&ft);
+        iterbuf = malloc(iterbuf_size);
+        figiter = ft_read_init(&ft, iterbuf, iterbuf_size, 0, 0);
+        for (start = 0; start < MAX_FILE_SIZE; start++) {
+            for (end = start; end < MAX_FILE_SIZE; end++) {
+                fti_seek(figiter, start, end);
+                j = start;
+                while (fti_next(figiter, &fig) && j <= end) {
+                    j = fig.irange.right > end ? MAX_FILE_SIZE + 1 :
+                        check_fig(&fig, file, j, "edits");
+                }
+                for (; j <= end; j++) {
+                    if (file[j] != (figtree_value_t) MAGIC) {
+                        j = MAX_FILE_SIZE + 1;
+                    }
+                }
+                if (j > MAX_FILE_SIZE) {
+                    fprintf(stderr, "[ERROR] edits: read of [%lu, %lu] is "
+                            "wrong\n", (long unsigned int) start,
+                            (long unsigned int) end);
+                    free(iterbuf);
+                    goto done;
+                }
+            }
+        }
+        free(iterbuf);
+    }
+
+    /* Erasing everything must take the tree back down to an empty root. */
+    ft_stats(&ft, &before);
+    ft_erase(&ft, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    ft_stats(&ft, &after);
+    if (after.height != 0 || after.nodes != 1 || after.entries != 0 ||
+        (before.height > 0 && after.height >= before.height) ||
+        ft_lookup(&ft, (byte_index_t) (seed & BYTE_INDEX_MASK)) != NULL) {
+        fprintf(stderr, "[ERROR] The tree is not empty after a full erase "
+                "(height %d, %lu nodes)\n", after.height,
+                (long unsigned int) after.nodes);
+    }
+
+    done:
+    ft_dealloc(&ft);
+    return seed;
+}
+
+/* Checks that a frozen copy of a tree, moved to another buffer as if it had
+ * been written out and mmap'ed, answers lookups and reads like the tree. */
+void test_frozen(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct figtree_flat* frozen;
+    struct figtree_flat* opened;
+    figflatiter_t* flatiter;
+    figtree_value_t* res;
+    void* buf;
+    size_t size;
+    fig_t fig;
+    byte_index_t j;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    frozen = ft_freeze(&ft);
+    size = ftf_size(frozen);
+    buf = malloc(size);
+    memcpy(buf, frozen, size);
+    ftf_dealloc(frozen);
+    ft_dealloc(&ft);
+
+    opened = ftf_open(buf, size);
+    if (opened == NULL || ftf_open(buf, size - 1) != NULL) {
+        fprintf(stderr, "[ERROR] frozen: ftf_open is wrong\n");
+        free(buf);
+        return;
+    }
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        res = ftf_lookup(opened, j);
+        if ((res == NULL ? (figtree_value_t) MAGIC : *res) != file[j]) {
+            fprintf(stderr, "[ERROR] frozen: lookup of byte %lu is wrong\n",
+                    (long unsigned int) j);
+            break;
+        }
+    }
+    flatiter = ftf_read(opened, 0, BYTE_INDEX_MAX);
+    j = 0;
+    while (ftfi_next(flatiter, &fig)) {
+        j = check_fig(&fig, file, j, "frozen");
+    }
+    ftfi_free(flatiter);
+    check_end(file, j, "frozen");
+    free(buf);
+}
+
+/* Copies the FIGs of FT into a new array, and returns how many there are. */
+size_t collect_figs(figtree_t* ft, struct fig** figs) {
+    figiter_t* figiter = ft_read(ft, 0, BYTE_INDEX_MAX);
+    size_t num = 0;
+
+    /* Each FIG maps at least one byte of the file. */
+    *figs = malloc(MAX_FILE_SIZE * sizeof(struct fig));
+    while (fti_next(figiter, &(*figs)[num])) {
+        num++;
+    }
+    fti_free(figiter);
+    return num;
+}
+
+/* Checks ft_overlay, both into a new tree and in place, and ft_load. */
+void test_overlay(unsigned int seed) {
+    figtree_t dst, src, result, loaded;
+    figtree_value_t dstfile[MAX_FILE_SIZE];
+    figtree_value_t srcfile[MAX_FILE_SIZE];
+    figtree_value_t merged[MAX_FILE_SIZE];
+    struct fig* figs;
+    size_t num_figs;
+    byte_index_t j;
+
+    init_file(&dst, dstfile);
+    init_file(&src, srcfile);
+    random_writes(&dst, dstfile, &seed, CHECK_WRITES);
+    random_writes(&src, srcfile, &seed, CHECK_WRITES / 4);
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        merged[j] = srcfile[j] != (figtree_value_t) MAGIC ? srcfile[j] :
+            dstfile[j];
+    }
+
+    ft_overlay(&dst, &src, &result);
+    check_contents(&result, merged, "overlay");
+    check_contents(&dst, dstfile, "overlay (dst)");
+    check_contents(&src, srcfile, "overlay (src)");
+    ft_dealloc(&result);
+    ft_overlay(&dst, &src, NULL);
+    check_contents(&dst, merged, "overlay in place");
+
+    num_figs = collect_figs(&dst, &figs);
+    ft_load(&loaded, figs, num_figs);
+    check_contents(&loaded, merged, "load");
+    free(figs);
+    ft_dealloc(&loaded);
+    ft_dealloc(&src);
+    ft_dealloc(&dst);
+}
+
+struct diff_check {
+    figtree_value_t* oldfile;
+    figtree_value_t* newfile;
+    bool differs[MAX_FILE_SIZE]; // reported by ft_diff
+    byte_index_t next; // first byte past the last range reported
+    bool ok;
+};
+
+void check_diff_range(struct interval* range, figtree_value_t* oldval,
+                      figtree_value_t* newval, void* arg) {
+    struct diff_check* check = arg;
+    figtree_value_t oldv = oldval == NULL ? (figtree_value_t) MAGIC : *oldval;
+    figtree_value_t newv = newval == NULL ? (figtree_value_t) MAGIC : *newval;
+    byte_index_t j;
+
+    if (range->left < check->next || range->right >= MAX_FILE_SIZE ||
+        oldv == newv) {
+        check->ok = false;
+        return;
+    }
+    for (j = range->left; j <= range->right; j++) {
+        if (check->oldfile[j] != oldv || check->newfile[j] != newv) {
+            check->ok = false;
+        }
+        check->differs[j] = true;
+    }
+    check->next = range->right + 1;
+}
+
+/* Checks that ft_diff reports exactly the bytes that differ between two
+ * trees, with their values in each. */
+void test_diff(unsigned int seed) {
+    figtree_t a, b;
+    figtree_value_t afile[MAX_FILE_SIZE];
+    figtree_value_t bfile[MAX_FILE_SIZE];
+    struct diff_check check;
+    unsigned int bseed = seed;
+    byte_index_t j;
+
+    init_file(&a, afile);
+    init_file(&b, bfile);
+    random_writes(&a, afile, &seed, CHECK_WRITES);
+    random_writes(&b, bfile, &bseed, CHECK_WRITES);
+    random_writes(&b, bfile, &bseed, CHECK_WRITES / 8);
+
+    memset(&check, 0x00, sizeof(check));
+    check.oldfile = afile;
+    check.newfile = bfile;
+    check.ok = true;
+    ft_diff(&a, &b, check_diff_range, &check);
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        if (check.differs[j] != (afile[j] != bfile[j])) {
+            check.ok = false;
+        }
+    }
+    check.next = MAX_FILE_SIZE; // any call for the same tree is an error
+    ft_diff(&a, &a, check_diff_range, &check);
+    if (!check.ok) {
+        fprintf(stderr, "[ERROR] diff: reported ranges are wrong\n");
+    }
+    ft_dealloc(&b);
+    ft_dealloc(&a);
+}
+
+struct exchange_check {
+    figtree_value_t* file; // before the write
+    byte_index_t start;
+    byte_index_t end;
+    byte_index_t next; // first byte past the last FIG reported
+    bool ok;
+};
+
+void check_shadowed(struct fig* fig, void* arg) {
+    struct exchange_check* check = arg;
+    byte_index_t j;
+
+    if (fig->irange.left < check->next || fig->irange.right > check->end) {
+        check->ok = false;
+        return;
+    }
+    for (j = check->next; j <= fig->irange.right; j++) {
+        if (check->file[j] != (j < fig->irange.left ?
+                               (figtree_value_t) MAGIC : fig->value)) {
+            check->ok = false;
+        }
+    }
+    check->next = fig->irange.right + 1;
+}
+
+/* Checks that ft_write_exchange reports, in order, what each write shadows,
+ * and writes like ft_write. */
+void test_write_exchange(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct exchange_check check;
+    figtree_value_t value;
+    byte_index_t j;
+    int i;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    check.file = file;
+    check.ok = true;
+    for (i = 0; i < CHECK_WRITES; i++) {
+        check.start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        check.end = check.start +
+            (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK) / 8;
+        if (check.end >= MAX_FILE_SIZE) {
+            check.end = MAX_FILE_SIZE - 1;
+        }
+        check.next = check.start;
+        value = (figtree_value_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+        ft_write_exchange(&ft, check.start, check.end, value, check_shadowed,
+                          &check);
+        for (j = check.next; j <= check.end; j++) {
+            if (file[j] != (figtree_value_t) MAGIC) {
+                check.ok = false;
+            }
+        }
+        for (j = check.start; j <= check.end; j++) {
+            file[j] = value;
+        }
+    }
+    if (!check.ok) {
+        fprintf(stderr, "[ERROR] write_exchange: shadowed FIGs are wrong\n");
+    }
+    check_contents(&ft, file, "write_exchange");
+    ft_dealloc(&ft);
+}
+
+/* Checks that ft_write_if writes only when the whole range holds the
+ * expected value, and reports the conflicting ranges otherwise. The conflicts
+ * are checked like the ranges from ft_diff, against a copy of the file that
+ * holds the expected value throughout the range. */
+void test_write_if(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figtree_value_t expectedfile[MAX_FILE_SIZE];
+    struct diff_check check;
+    byte_index_t start, end, j;
+    figtree_value_t expected, value;
+    bool matches, written, ok = true;
+    int i, successes = 0;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    for (i = 0; i < CHECK_WRITES; i++) {
+        start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        end = start + (byte_index_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+        if (end >= MAX_FILE_SIZE) {
+            end = MAX_FILE_SIZE - 1;
+        }
+        expected = file[start] != (figtree_value_t) MAGIC ? file[start] :
+            (figtree_value_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+        value = (figtree_value_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+
+        memcpy(expectedfile, file, sizeof(file));
+        matches = true;
+        for (j = start; j <= end; j++) {
+            matches = matches && file[j] == expected;
+            expectedfile[j] = expected;
+        }
+        memset(&check, 0x00, sizeof(check));
+        check.oldfile = file;
+        check.newfile = expectedfile;
+        check.ok = true;
+        written = ft_write_if(&ft, start, end, expected, value,
+                              check_diff_range, &check);
+        for (j = 0; j < MAX_FILE_SIZE; j++) {
+            if (check.differs[j] != (file[j] != expectedfile[j])) {
+                check.ok = false;
+            }
+        }
+        if (written != matches || !check.ok) {
+            ok = false;
+        }
+        if (written) {
+            successes++;
+            for (j = start; j <= end; j++) {
+                file[j] = value;
+            }
+        }
+    }
+    if (!ok || successes == 0 || successes == CHECK_WRITES) {
+        fprintf(stderr, "[ERROR] write_if: results or conflicts are wrong\n");
+    }
+    check_contents(&ft, file, "write_if");
+    ft_dealloc(&ft);
+}
+
+/* Checks ft_count_mapped against the reference, and ft_count_figs against
+ * the number of FIGs that ft_read yields, over random ranges. */
+void test_counts(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figiter_t* figiter;
+    fig_t fig;
+    byte_index_t start, end, j;
+    uint64_t mapped, figs;
+    int i;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    for (i = 0; i < CHECK_WRITES; i++) {
+        start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        end = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        if (end < start) {
+            j = start;
+            start = end;
+            end = j;
+        }
+        mapped = 0;
+        for (j = start; j <= end; j++) {
+            mapped += file[j] != (figtree_value_t) MAGIC;
+        }
+        figs = 0;
+        figiter = ft_read(&ft, start, end);
+        while (fti_next(figiter, &fig)) {
+            figs++;
+        }
+        fti_free(figiter);
+        if (ft_count_mapped(&ft, start, end) != mapped ||
+            ft_count_figs(&ft, start, end) != figs) {
+            fprintf(stderr, "[ERROR] counts: wrong for [%lu, %lu]\n",
+                    (long unsigned int) start, (long unsigned int) end);
+            break;
+        }
+    }
+    ft_dealloc(&ft);
+}
+
+struct value_check {
+    figtree_value_t* file;
+    figtree_value_t value;
+    byte_index_t next; // first byte past the last FIG reported
+    bool ok;
+};
+
+void check_value_range(struct fig* fig, void* arg) {
+    struct value_check* check = arg;
+    byte_index_t j;
+
+    if (fig->irange.left < check->next || fig->irange.right >= MAX_FILE_SIZE ||
+        fig->value != check->value) {
+        check->ok = false;
+        return;
+    }
+    for (j = check->next; j <= fig->irange.right; j++) {
+        if ((check->file[j] == check->value) != (j >= fig->irange.left)) {
+            check->ok = false;
+        }
+    }
+    check->next = fig->irange.right + 1;
+}
+
+/* Checks ft_ranges_for_value, with the reverse index built partway through
+ * the writes, so that both building and maintaining it are covered. */
+void test_value_index(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct value_check check;
+    byte_index_t start, end, j;
+    int i;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    ft_index_values(&ft);
+    for (i = 0; i < CHECK_WRITES / 8; i++) {
+        random_writes(&ft, file, &seed, 8);
+        start = (byte_index_t) (rand_r(&seed) & BYTE_INDEX_MASK);
+        end = start + (byte_index_t) (rand_r(&seed) & MAX_WRITE_MASK);
+        if (end >= MAX_FILE_SIZE) {
+            end = MAX_FILE_SIZE - 1;
+        }
+        ft_erase(&ft, start, end);
+        for (j = start; j <= end; j++) {
+            file[j] = MAGIC;
+        }
+    }
+
+    check.file = file;
+    check.ok = true;
+    for (check.value = 0; check.value <= CHECK_VALUE_MASK; check.value++) {
+        check.next = 0;
+        ft_ranges_for_value(&ft, check.value, check_value_range, &check);
+        for (j = check.next; j < MAX_FILE_SIZE; j++) {
+            if (file[j] == check.value) {
+                check.ok = false;
+            }
+        }
+    }
+    if (!check.ok) {
+        fprintf(stderr, "[ERROR] value index: ranges are wrong\n");
+    }
+    ft_dealloc(&ft);
+}
+
+/* Stores the FIGs that ft_read yields for [START, END] in FIGS, which has
+ * room for MAX_FILE_SIZE of them, and returns how many there are. */
+size_t read_figs(figtree_t* ft, byte_index_t start, byte_index_t end,
+                 struct fig* figs) {
+    figiter_t* figiter = ft_read(ft, start, end);
+    size_t num = 0;
+    while (fti_next(figiter, &figs[num])) {
+        num++;
+    }
+    fti_free(figiter);
+    return num;
+}
+
+bool same_fig(struct fig* a, struct fig* b) {
+    return a->irange.left == b->irange.left &&
+        a->irange.right == b->irange.right && a->value == b->value;
+}
+
+/* Picks a random range within the file. */
+void random_range(unsigned int* seed, byte_index_t* start, byte_index_t* end) {
+    byte_index_t a = (byte_index_t) (rand_r(seed) & BYTE_INDEX_MASK);
+    byte_index_t b = (byte_index_t) (rand_r(seed) & BYTE_INDEX_MASK);
+    *start = MIN(a, b);
+    *end = MAX(a, b);
+}
+
+/* Checks that fti_next_batch, with batches of several sizes, yields the same
+ * FIGs as fti_next. */
+void test_next_batch(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct fig expected[MAX_FILE_SIZE];
+    struct fig batch[MAX_WRITE_MASK + 1];
+    figiter_t* figiter;
+    byte_index_t start, end;
+    size_t num, got, cap, i, b;
+    bool ok = true;
+    int k;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    for (k = 0; k < CHECK_WRITES && ok; k++) {
+        random_range(&seed, &start, &end);
+        cap = 1 + (size_t) (rand_r(&seed) & MAX_WRITE_MASK);
+        num = read_figs(&ft, start, end, expected);
+        figiter = ft_read(&ft, start, end);
+        i = 0;
+        while (ok && (got = fti_next_batch(figiter, batch, cap)) != 0) {
+            ok = got <= cap && i + got <= num;
+            for (b = 0; ok && b < got; b++, i++) {
+                ok = same_fig(&batch[b], &expected[i]);
+            }
+        }
+        fti_free(figiter);
+        ok = ok && i == num;
+    }
+    if (!ok) {
+        fprintf(stderr, "[ERROR] next_batch: batches differ from fti_next\n");
+    }
+    ft_dealloc(&ft);
+}
+
+/* Checks that an iterator built in caller-owned storage, and moved around
+ * with fti_seek in random order, yields the same FIGs as a new iterator. */
+void test_seek(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct fig expected[MAX_FILE_SIZE];
+    figiter_t* figiter;
+    void* iterbuf;
+    size_t iterbuf_size, num, i;
+    byte_index_t start, end;
+    fig_t fig;
+    bool ok = true;
+    int k;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    iterbuf_size = ft_read_size(&ft);
+    iterbuf = malloc(iterbuf_size);
+    figiter = ft_read_init(&ft, iterbuf, iterbuf_size, 0, BYTE_INDEX_MAX);
+    for (k = 0; k < CHECK_WRITES && ok; k++) {
+        random_range(&seed, &start, &end);
+        num = read_figs(&ft, start, end, expected);
+        fti_seek(figiter, start, end);
+        for (i = 0; ok && fti_next(figiter, &fig); i++) {
+            ok = i < num && same_fig(&fig, &expected[i]);
+        }
+        ok = ok && i == num;
+    }
+    if (!ok) {
+        fprintf(stderr, "[ERROR] seek: FIGs differ from a new iterator\n");
+    }
+    free(iterbuf);
+    ft_dealloc(&ft);
+}
+
+/* Checks that ft_read_reverse yields the FIGs of ft_read in reverse, also
+ * when the iterator is repositioned with fti_seek part-way through. */
+void test_reverse(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct fig expected[MAX_FILE_SIZE];
+    figiter_t* figiter;
+    figiter_t* seekiter;
+    size_t num, i;
+    byte_index_t start, end;
+    fig_t fig;
+    bool ok = true, seekok = true;
+    int k;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    seekiter = ft_read_reverse(&ft, BYTE_INDEX_MIN, BYTE_INDEX_MAX);
+    for (k = 0; k < CHECK_WRITES && ok && seekok; k++) {
+        random_range(&seed, &start, &end);
+        num = read_figs(&ft, start, end, expected);
+        figiter = ft_read_reverse(&ft, start, end);
+        for (i = num; ok && fti_prev(figiter, &fig); i--) {
+            ok = i > 0 && same_fig(&fig, &expected[i - 1]);
+        }
+        fti_free(figiter);
+        ok = ok && i == 0;
+
+        /* Every other range is only read half-way, so that the next seek
+         * starts from the middle of the tree. */
+        fti_seek(seekiter, start, end);
+        for (i = num; seekok && i > ((k & 1) ? num / 2 : 0); i--) {
+            seekok = fti_prev(seekiter, &fig) &&
+                same_fig(&fig, &expected[i - 1]);
+        }
+        seekok = seekok && ((k & 1) || !fti_prev(seekiter, &fig));
+    }
+    fti_free(seekiter);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] reverse: FIGs differ from ft_read\n");
+    }
+    if (!seekok) {
+        fprintf(stderr, "[ERROR] reverse: FIGs differ after fti_seek\n");
+    }
+    ft_dealloc(&ft);
+}
+
+struct foreach_check {
+    struct fig* expected;
+    size_t num;
+    size_t seen;
+    size_t stop_after; // FN returns false on this many FIGs
+    bool ok;
+};
+
+bool check_foreach_fig(struct fig* fig, void* arg) {
+    struct foreach_check* check = arg;
+    if (check->seen >= check->num ||
+        !same_fig(fig, &check->expected[check->seen])) {
+        check->ok = false;
+    }
+    return ++check->seen != check->stop_after;
+}
+
+/* Checks that ft_foreach visits the FIGs of ft_read, in order, and stops as
+ * soon as the visitor returns false. */
+void test_foreach(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct fig expected[MAX_FILE_SIZE];
+    struct foreach_check check;
+    byte_index_t start, end;
+    bool finished;
+    int k;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    check.expected = expected;
+    check.ok = true;
+    for (k = 0; k < CHECK_WRITES && check.ok; k++) {
+        random_range(&seed, &start, &end);
+        check.num = read_figs(&ft, start, end, expected);
+        check.seen = 0;
+        check.stop_after = (size_t) (rand_r(&seed) & MAX_WRITE_MASK);
+        finished = ft_foreach(&ft, start, end, check_foreach_fig, &check);
+        if (check.stop_after != 0 && check.stop_after <= check.num) {
+            check.ok = check.ok && !finished &&
+                check.seen == check.stop_after;
+        } else {
+            check.ok = check.ok && finished && check.seen == check.num;
+        }
+    }
+    if (!check.ok) {
+        fprintf(stderr, "[ERROR] foreach: FIGs differ from ft_read\n");
+    }
+    ft_dealloc(&ft);
+}
+
+#define CHECK_CHUNKS 8
+
+struct parallel_check {
+    struct fig* figs[CHECK_CHUNKS]; // room for MAX_FILE_SIZE FIGs each
+    size_t num[CHECK_CHUNKS];
+};
+
+bool collect_chunk_fig(struct fig* fig, int chunk, void* arg) {
+    struct parallel_check* check = arg;
+    check->figs[chunk][check->num[chunk]++] = *fig;
+    return true;
+}
+
+/* Checks that ft_split cuts ranges into consecutive chunks at FIG
+ * boundaries, and that ft_foreach_parallel visits the FIGs of each chunk in
+ * order. Together, the chunks must yield the FIGs of the whole range. */
+void test_split(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct fig expected[MAX_FILE_SIZE];
+    struct fig chunkfigs[MAX_FILE_SIZE];
+    struct interval chunks[CHECK_CHUNKS];
+    struct parallel_check check;
+    byte_index_t start, end;
+    size_t num, seen, chunknum, i;
+    int num_chunks, c, k;
+    bool ok = true;
+
+    for (c = 0; c < CHECK_CHUNKS; c++) {
+        check.figs[c] = malloc(MAX_FILE_SIZE * sizeof(struct fig));
+    }
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    for (k = 0; k < CHECK_WRITES / 8 && ok; k++) {
+        random_range(&seed, &start, &end);
+        num = read_figs(&ft, start, end, expected);
+        num_chunks = ft_split(&ft, start, end, chunks,
+                              1 + (rand_r(&seed) % CHECK_CHUNKS));
+        memset(check.num, 0x00, sizeof(check.num));
+        ft_foreach_parallel(&ft, chunks, num_chunks, 3, collect_chunk_fig,
+                            &check);
+        seen = 0;
+        for (c = 0; c < num_chunks && ok; c++) {
+            ok = chunks[c].left == (c == 0 ? start : chunks[c - 1].right + 1);
+            chunknum = read_figs(&ft, chunks[c].left, chunks[c].right,
+                                 chunkfigs);
+            ok = ok && chunknum == check.num[c] && seen + chunknum <= num;
+            for (i = 0; ok && i < chunknum; i++, seen++) {
+                ok = same_fig(&chunkfigs[i], &expected[seen]) &&
+                    same_fig(&check.figs[c][i], &expected[seen]);
+            }
+        }
+        ok = ok && chunks[num_chunks - 1].right == end && seen == num;
+    }
+    if (!ok) {
+        fprintf(stderr, "[ERROR] split: chunks do not add up to the range\n");
+    }
+    for (c = 0; c < CHECK_CHUNKS; c++) {
+        free(check.figs[c]);
+    }
+    ft_dealloc(&ft);
+}
+
+#define CHECK_LOAD_FIGS 50000
+
+/* Checks that ft_load_parallel builds the same tree as ft_load, from the
+ * FIGs of a random tree and from a large generated set. */
+void test_load_parallel(unsigned int seed) {
+    figtree_t ft, serial, parallel;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct ft_stats serialstats, parallelstats;
+    struct fig* figs;
+    figiter_t* serialiter;
+    figiter_t* paralleliter;
+    fig_t serialfig, parallelfig;
+    bool hasserial, hasparallel, ok;
+    size_t num_figs, i;
+    int threads;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    num_figs = collect_figs(&ft, &figs);
+    for (threads = 1; threads <= 4; threads++) {
+        ft_load_parallel(&parallel, figs, num_figs, threads);
+        check_contents(&parallel, file, "load_parallel");
+        ft_dealloc(&parallel);
+    }
+    free(figs);
+    ft_dealloc(&ft);
+
+    figs = malloc(CHECK_LOAD_FIGS * sizeof(struct fig));
+    for (i = 0; i < CHECK_LOAD_FIGS; i++) {
+        i_init(&figs[i].irange, (byte_index_t) (i << 2),
+               (byte_index_t) ((i << 2) + 2));
+        figs[i].value = (figtree_value_t) rand_r(&seed);
+    }
+    ft_load(&serial, figs, CHECK_LOAD_FIGS);
+    ft_load_parallel(&parallel, figs, CHECK_LOAD_FIGS, 3);
+    ft_stats(&serial, &serialstats);
+    ft_stats(&parallel, &parallelstats);
+    ok = serialstats.height == parallelstats.height &&
+        serialstats.nodes == parallelstats.nodes;
+    serialiter = ft_read(&serial, 0, BYTE_INDEX_MAX);
+    paralleliter = ft_read(&parallel, 0, BYTE_INDEX_MAX);
+    do {
+        hasserial = fti_next(serialiter, &serialfig);
+        hasparallel = fti_next(paralleliter, &parallelfig);
+        ok = ok && hasserial == hasparallel &&
+            (!hasserial || same_fig(&serialfig, &parallelfig));
+    } while (ok && hasserial);
+    fti_free(serialiter);
+    fti_free(paralleliter);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] load_parallel: differs from ft_load\n");
+    }
+    free(figs);
+    ft_dealloc(&parallel);
+    ft_dealloc(&serial);
+}
+
+#define CHECK_ASYNC_THREADS 4
+#define CHECK_ASYNC_STRIPE (MAX_FILE_SIZE / CHECK_ASYNC_THREADS)
+
+struct async_check {
+    struct figtree_async* writer;
+    figtree_value_t* file;
+    int stripe; // each thread writes only to its own stripe of the file
+    unsigned int seed;
+    bool ok;
+    pthread_barrier_t* barrier;
+    struct figtree_async** next_writer;
+};
+
+void* check_async_writes(void* arg) {
+    struct async_check* check = arg;
+    figtree_t* tree;
+    figtree_value_t* res;
+    figtree_value_t value;
+    byte_index_t first = (byte_index_t) (check->stripe * CHECK_ASYNC_STRIPE);
+    byte_index_t start, end, j;
+    bool written;
+    int i;
+
+    for (i = 0; i < CHECK_WRITES; i++) {
+        start = first + (byte_index_t) (rand_r(&check->seed) %
+                                        CHECK_ASYNC_STRIPE);
+        end = start + (byte_index_t) (rand_r(&check->seed) & MAX_WRITE_MASK);
+        end = MIN(end, first + CHECK_ASYNC_STRIPE - 1);
+        value = (figtree_value_t) (rand_r(&check->seed) & CHECK_VALUE_MASK);
+        if ((i & 0x7) == 0) {
+            /* Nothing else writes to the stripe, so FILE is up to date, and
+             * the write must happen unless the byte is unmapped. */
+            end = start;
+            written = ft_write_if_async(check->writer, start, end,
+                                        check->file[start], value, NULL,
+                                        NULL);
+            check->ok = check->ok && written ==
+                (check->file[start] != (figtree_value_t) MAGIC);
+        } else {
+            written = true;
+            ft_write_async(check->writer, start, end, value);
+        }
+        for (j = start; j <= end && written; j++) {
+            check->file[j] = value;
+        }
+        if ((i & 0xf) == 0) {
+            /* Reads see the writes that this thread queued before them. */
+            tree = fta_read_begin(check->writer);
+            res = ft_lookup(tree, end);
+            check->ok = check->ok &&
+                (res == NULL ? (figtree_value_t) MAGIC : *res) ==
+                check->file[end];
+            fta_read_end(check->writer);
+        }
+    }
+
+    /* Once another thread has freed the writer and started a new one, which
+     * may well be at the same address, this thread must not wait on the new
+     * one for the writes it queued to the old one. */
+    pthread_barrier_wait(check->barrier);
+    pthread_barrier_wait(check->barrier);
+    fta_read_begin(*check->next_writer);
+    fta_read_end(*check->next_writer);
+    return NULL;
+}
+
+/* Checks the asynchronous writer: several threads queue writes, some of them
+ * conditional, and check that they read their own writes, also when they
+ * write through more than one writer. */
+void test_async(unsigned int seed) {
+    figtree_t ft, other;
+    figtree_t* tree;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figtree_value_t* res;
+    struct async_check checks[CHECK_ASYNC_THREADS];
+    pthread_t threads[CHECK_ASYNC_THREADS];
+    pthread_barrier_t barrier;
+    struct figtree_async* writer;
+    struct figtree_async* next_writer = NULL;
+    struct figtree_async* other_writer;
+    bool ok = true;
+    int t, i;
+
+    init_file(&ft, file);
+    writer = fta_new(&ft, 16);
+    pthread_barrier_init(&barrier, NULL, CHECK_ASYNC_THREADS + 1);
+    for (t = 0; t < CHECK_ASYNC_THREADS; t++) {
+        checks[t].writer = writer;
+        checks[t].file = file;
+        checks[t].stripe = t;
+        checks[t].seed = seed + (unsigned int) t;
+        checks[t].ok = true;
+        checks[t].barrier = &barrier;
+        checks[t].next_writer = &next_writer;
+        pthread_create(&threads[t], NULL, check_async_writes, &checks[t]);
+    }
+    pthread_barrier_wait(&barrier);
+    ft_flush(writer);
+    check_contents(fta_read_begin(writer), file, "async");
+    fta_read_end(writer);
+    fta_free(writer);
+    next_writer = fta_new(&ft, 16);
+    pthread_barrier_wait(&barrier);
+    for (t = 0; t < CHECK_ASYNC_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        ok = ok && checks[t].ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "[ERROR] async: a thread did not read its writes\n");
+    }
+    fta_free(next_writer);
+    pthread_barrier_destroy(&barrier);
+
+    /* A write queued to another writer since must not hide the one queued to
+     * this tree's writer from a read of it. */
+    ft_init(&other);
+    writer = fta_new(&ft, 16);
+    other_writer = fta_new(&other, 16);
+    for (i = 0; i < CHECK_WRITES && ok; i++) {
+        ft_write_async(writer, 0, 0, (figtree_value_t) i);
+        ft_write_async(other_writer, 0, 0, (figtree_value_t) i);
+        tree = fta_read_begin(writer);
+        res = ft_lookup(tree, 0);
+        ok = res != NULL && *res == (figtree_value_t) i;
+        fta_read_end(writer);
+    }
+    if (!ok) {
+        fprintf(stderr, "[ERROR] async: a read missed a write queued before "
+                "one to another writer\n");
+    }
+    fta_free(other_writer);
+    fta_free(writer);
+    ft_dealloc(&other);
+    ft_dealloc(&ft);
+}
+
+/* Checks that lookups and reads see writes that are still in the write
+ * buffer, with several buffer sizes, and that nothing is lost when the
+ * buffer is flushed or removed. */
+void test_write_buffer(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    size_t limit;
+    int i;
+
+    init_file(&ft, file);
+    for (limit = 1; limit <= 64; limit *= 4) {
+        ft_set_write_buffer(&ft, limit);
+        for (i = 0; i < 8; i++) {
+            random_writes(&ft, file, &seed,
+                          (int) (rand_r(&seed) % (2 * limit + 1)));
+            if (!check_contents(&ft, file, "write buffer")) {
+                break;
+            }
+        }
+        if (limit > 8) {
+            ft_flush_write_buffer(&ft);
+        }
+    }
+    ft_set_write_buffer(&ft, 0);
+    check_contents(&ft, file, "write buffer (removed)");
+    ft_dealloc(&ft);
+}
+
+/* Checks that the numbers in ft_stats agree with each other and with the
+ * reference array, and that the write buffer is counted on its own. */
+void test_stats(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct ft_stats stats, buffered;
+    uint64_t nodes = 0, nodes_by_entries = 0, entries = 0, mapped = 0;
+    byte_index_t j;
+    int i;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    ft_stats(&ft, &stats);
+    for (i = 0; i < FT_STATS_MAX_HEIGHT; i++) {
+        nodes += stats.nodes_per_level[i];
+    }
+    for (i = 0; i < FT_SPLITLIMIT; i++) {
+        nodes_by_entries += stats.entries_per_node[i];
+        entries += (uint64_t) i * stats.entries_per_node[i];
+    }
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        mapped += file[j] != (figtree_value_t) MAGIC;
+    }
+    if (stats.height != ft.root.HEIGHT ||
+        stats.nodes_per_level[stats.height] != 1 || nodes != stats.nodes ||
+        nodes_by_entries != stats.nodes || entries != stats.entries ||
+        stats.live_entries + stats.shadowed_entries != stats.entries ||
+        stats.mapped_bytes != mapped || stats.buffered_ranges != 0 ||
+        stats.allocated_bytes != (stats.nodes - 1) * sizeof(struct ft_node) ||
+        stats.fill_factor <= 0 || stats.fill_factor > 1) {
+        fprintf(stderr, "[ERROR] stats: counts do not add up\n");
+    }
+
+    ft_set_write_buffer(&ft, MAX_FILE_SIZE);
+    ft_write(&ft, 0, 0, 1);
+    ft_write(&ft, 2, 3, 1);
+    ft_stats(&ft, &buffered);
+    if (buffered.buffered_ranges != 2 || buffered.entries != stats.entries ||
+        buffered.allocated_bytes <= stats.allocated_bytes) {
+        fprintf(stderr, "[ERROR] stats: buffered writes are miscounted\n");
+    }
+    ft_dealloc(&ft);
+}
+
+void* write_on_thread(void* arg) {
+    unsigned int seed = 1;
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    ft_dealloc(&ft);
+    return arg;
+}
+
+/* Checks that the profiling counters keep the counts of threads that have
+ * exited, and that they are all zero when profiling is compiled out. */
+void test_profile(void) {
+    struct ftp_snapshot before, after;
+    pthread_t thread;
+    uint64_t visits;
+    int t;
+
+    ftp_reset();
+    write_on_thread(NULL);
+    ftp_snapshot(&before);
+    for (t = 0; t < 4; t++) {
+        pthread_create(&thread, NULL, write_on_thread, NULL);
+        pthread_join(thread, NULL);
+    }
+    ftp_snapshot(&after);
+    visits = before.counters[FTP_NODE_VISITS];
+#ifdef FT_PROFILE
+    if (visits == 0 || after.counters[FTP_NODE_VISITS] != 5 * visits) {
+#else
+    if (visits != 0 || after.counters[FTP_NODE_VISITS] != 0) {
+#endif
+        fprintf(stderr, "[ERROR] profile: node visits are miscounted\n");
+    }
+    ftp_reset();
+    ftp_snapshot(&after);
+    if (after.counters[FTP_NODE_VISITS] != 0) {
+        fprintf(stderr, "[ERROR] profile: reset left counts behind\n");
+    }
+}
+
+void count_diff(struct interval* range, figtree_value_t* oldval,
+                figtree_value_t* newval, void* arg) {
+    (void) range;
+    (void) oldval;
+    (void) newval;
+    (*(int*) arg)++;
+}
+
+bool visit_nothing(struct fig* fig, void* arg) {
+    (void) fig;
+    (void) arg;
+    return false;
+}
+
+/* Checks that replaying a trace gives the same tree, for a tree that was
+ * loaded before the trace started and then updated in every way, and that
+ * every scan is recorded as a read. */
+void test_trace(unsigned int seed) {
+    figtree_t ft, src, replayed;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figtree_value_t srcfile[MAX_FILE_SIZE];
+    struct ft_trace* trace;
+    struct ftr_record record;
+    struct fig* figs;
+    figiter_t* figiter;
+    byte_index_t start, end;
+    size_t num_figs;
+    FILE* out;
+    int i, reads = 0, diffs = 0;
+
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    num_figs = collect_figs(&ft, &figs);
+    ft_dealloc(&ft);
+    ft_load(&ft, figs, num_figs);
+    free(figs);
+    init_file(&src, srcfile);
+    random_writes(&src, srcfile, &seed, CHECK_WRITES / 8);
+
+    out = tmpfile();
+    trace = ftr_open(out);
+    ft_set_trace(&ft, trace);
+    for (i = 0; i < CHECK_WRITES / 8; i++) {
+        random_range(&seed, &start, &end);
+        ft_write_exchange(&ft, start, start + (end - start) / 8, 1, NULL,
+                          NULL);
+        ft_write_if(&ft, start, start, 1, 2, NULL, NULL);
+        ft_write_if(&ft, end, end, 3, 4, NULL, NULL);
+        ft_erase(&ft, end, end + (byte_index_t) (rand_r(&seed) & 0x3));
+        ft_shift(&ft, start + 1, (int64_t) (rand_r(&seed) & 0x3) - 1);
+        ft_foreach(&ft, start, end, visit_nothing, NULL);
+        figiter = ft_read(&ft, start, end);
+        fti_seek(figiter, end, end);
+        fti_free(figiter);
+    }
+    ft_overlay(&ft, &src, NULL);
+    ft_set_trace(&ft, NULL);
+    ftr_close(trace);
+
+    rewind(out);
+    ft_init(&replayed);
+    if (!ftr_read_header(out)) {
+        fprintf(stderr, "[ERROR] trace: the header is unreadable\n");
+    }
+    while (ftr_read_record(out, &record)) {
+        if (record.op == FTR_WRITE) {
+            ft_write(&replayed, record.start, record.end, record.value);
+        } else if (record.op == FTR_SHIFT) {
+            ft_shift(&replayed, record.start, (int64_t) record.value);
+        } else if (record.op == FTR_ERASE) {
+            ft_erase(&replayed, record.start, record.end);
+        } else if (record.op == FTR_READ) {
+            reads++;
+        }
+    }
+    fclose(out);
+    ft_diff(&ft, &replayed, count_diff, &diffs);
+    if (diffs != 0 || reads != 3 * (CHECK_WRITES / 8)) {
+        fprintf(stderr, "[ERROR] trace: replay differs from the tree\n");
+    }
+    ft_dealloc(&replayed);
+    ft_dealloc(&src);
+    ft_dealloc(&ft);
+}
+
+/* Checks that a tree of fewer than FT_SPLITLIMIT FIGs lives entirely in the
+ * struct, and that it moves back there after growing and being erased. */
+void test_small(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    struct ft_stats stats;
+    struct fig* figs;
+    size_t num_figs;
+    byte_index_t j;
+    int i;
+
+    init_file(&ft, file);
+    for (i = 0; i < FT_SPLITLIMIT - 1; i++) {
+        j = (byte_index_t) (i << 1);
+        file[j] = (figtree_value_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+        ft_write(&ft, j, j, file[j]);
+    }
+    ft_stats(&ft, &stats);
+    if (stats.height != 0 || stats.nodes != 1 || stats.allocated_bytes != 0) {
+        fprintf(stderr, "[ERROR] small: a small tree is not inline\n");
+    }
+    check_contents(&ft, file, "small");
+
+    num_figs = collect_figs(&ft, &figs);
+    ft_dealloc(&ft);
+    ft_load(&ft, figs, num_figs);
+    free(figs);
+    ft_stats(&ft, &stats);
+    if (stats.height != 0 || stats.nodes != 1 || stats.allocated_bytes != 0) {
+        fprintf(stderr, "[ERROR] small: a small loaded tree is not inline\n");
+    }
+    check_contents(&ft, file, "small load");
+
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    ft_stats(&ft, &stats);
+    if (stats.height == 0 || stats.allocated_bytes == 0) {
+        fprintf(stderr, "[ERROR] small: the tree did not grow out of the "
+                "struct\n");
+    }
+    check_contents(&ft, file, "small grown");
+
+    ft_erase(&ft, FT_SPLITLIMIT - 1, BYTE_INDEX_MAX);
+    for (j = FT_SPLITLIMIT - 1; j < MAX_FILE_SIZE; j++) {
+        file[j] = MAGIC;
+    }
+    ft_stats(&ft, &stats);
+    if (stats.height != 0 || stats.nodes != 1 || stats.allocated_bytes != 0) {
+        fprintf(stderr, "[ERROR] small: the erased tree is not inline "
+                "(height %d, %lu nodes)\n", stats.height,
+                (long unsigned int) stats.nodes);
+    }
+    check_contents(&ft, file, "small erased");
+    ft_dealloc(&ft);
+}
+
+/* Returns true if the reads of FT and PLAIN from START to the end of the
+ * bytes, and back from START to the beginning, yield the same FIGs. */
+bool same_reads(figtree_t* ft, figtree_t* plain, byte_index_t start) {
+    figiter_t* figiter;
+    figiter_t* plainiter;
+    fig_t fig, plainfig;
+    bool ok, hasfig, hasplainfig;
+
+    figiter = ft_read(ft, start, BYTE_INDEX_MAX);
+    plainiter = ft_read(plain, start, BYTE_INDEX_MAX);
+    do {
+        hasfig = fti_next(figiter, &fig);
+        hasplainfig = fti_next(plainiter, &plainfig);
+        ok = hasfig == hasplainfig && (!hasfig || same_fig(&fig, &plainfig));
+    } while (ok && hasfig);
+    fti_free(figiter);
+    fti_free(plainiter);
+
+    figiter = ft_read_reverse(ft, BYTE_INDEX_MIN, start);
+    plainiter = ft_read_reverse(plain, BYTE_INDEX_MIN, start);
+    hasfig = true;
+    while (ok && hasfig) {
+        hasfig = fti_prev(figiter, &fig);
+        hasplainfig = fti_prev(plainiter, &plainfig);
+        ok = hasfig == hasplainfig && (!hasfig || same_fig(&fig, &plainfig));
+    }
+    fti_free(figiter);
+    fti_free(plainiter);
+    return ok;
+}
+
+/* Checks that compressing the leaves of a tree of many short FIGs makes it
+ * much smaller, and that lookups, reads and counts still match a copy that
+ * is not compressed, also after writes, erases and shifts that unpack some
+ * of the leaves, and after compressing them again. */
+void test_compressed(unsigned int seed) {
+    figtree_t ft, plain;
+    struct ft_stats stats, plainstats;
+    struct fig* figs;
+    figtree_value_t* res;
+    figtree_value_t* plainres;
+    byte_index_t start, end, j;
+    int64_t delta;
+    bool ok = true;
+    int round;
+    size_t i;
+
+    figs = malloc(CHECK_LOAD_FIGS * sizeof(struct fig));
+    for (i = 0; i < CHECK_LOAD_FIGS; i++) {
+        i_init(&figs[i].irange, (byte_index_t) (i << 2),
+               (byte_index_t) ((i << 2) + (rand_r(&seed) & 0x3)));
+        figs[i].value = (figtree_value_t) (rand_r(&seed) & CHECK_VALUE_MASK);
+    }
+    ft_load(&ft, figs, CHECK_LOAD_FIGS);
+    ft_load(&plain, figs, CHECK_LOAD_FIGS);
+    free(figs);
+    ft_compress_leaves(&ft);
+    ft_stats(&ft, &stats);
+    ft_stats(&plain, &plainstats);
+    if (stats.compressed_leaves != plainstats.nodes_per_level[0] ||
+        stats.allocated_bytes * 5 > plainstats.allocated_bytes * 3) {
+        fprintf(stderr, "[ERROR] compressed: %lu of %lu leaves take %lu "
+                "bytes, %lu uncompressed\n",
+                (long unsigned int) stats.compressed_leaves,
+                (long unsigned int) plainstats.nodes_per_level[0],
+                (long unsigned int) stats.allocated_bytes,
+                (long unsigned int) plainstats.allocated_bytes);
+    }
+    /* Cached values point into the compressed leaves. */
+    ft_set_lookup_cache(&ft, true);
+
+    for (round = 0; ok && round < 3; round++) {
+        if (round == 1) {
+            for (i = 0; i < CHECK_WRITES; i++) {
+                start = (byte_index_t) (rand_r(&seed) %
+                                        (CHECK_LOAD_FIGS << 2)) + 0x10;
+                end = start + (byte_index_t) (rand_r(&seed) & 0xf);
+                delta = (int64_t) (rand_r(&seed) & 0x1f) - 0x10;
+                if (i % 3 == 0) {
+                    ft_write(&ft, start, end, (figtree_value_t) i);
+                    ft_write(&plain, start, end, (figtree_value_t) i);
+                } else if (i % 3 == 1) {
+                    ft_erase(&ft, start, end);
+                    ft_erase(&plain, start, end);
+                } else {
+                    ft_shift(&ft, start, delta);
+                    ft_shift(&plain, start, delta);
+                }
+            }
+        } else if (round == 2) {
+            ft_compress_leaves(&ft);
+        }
+
+        for (i = 0; ok && i < CHECK_WRITES; i++) {
+            j = (byte_index_t) (rand_r(&seed) % (CHECK_LOAD_FIGS << 2));
+            res = ft_lookup(&ft, j);
+            res = ft_lookup(&ft, j); // once more, from the cache
+            plainres = ft_lookup(&plain, j);
+            ok = (res == NULL) == (plainres == NULL) &&
+                (res == NULL || *res == *plainres);
+        }
+        for (i = 0; ok && i < CHECK_CHUNKS; i++) {
+            start = (byte_index_t) (rand_r(&seed) % (CHECK_LOAD_FIGS << 2));
+            ok = same_reads(&ft, &plain, start) &&
+                ft_count_figs(&ft, start, BYTE_INDEX_MAX) ==
+                ft_count_figs(&plain, start, BYTE_INDEX_MAX);
+        }
+        if (!ok) {
+            fprintf(stderr, "[ERROR] compressed: differs from the tree that "
+                    "is not compressed (round %d)\n", round);
+        }
+    }
+    ft_dealloc(&ft);
+    ft_dealloc(&plain);
+}
+
+/* The state of a typed foreach, checked against OWNER, the number of the
+ * write that last mapped each byte, or -1. */
+struct typed_check {
+    int64_t* owner;
+    byte_index_t start;
+    byte_index_t end;
+    byte_index_t next; // first byte not yet visited
+    int visits;
+    int limit; // stop after this many visits, if not 0
+    bool ok;
+};
+
+/* Checks that RANGE is exactly the part of one FIG written by write OWNER
+ * that lies in the checked range, and that no FIG was skipped before it. */
+bool check_typed_range(struct typed_check* check, struct interval* range,
+                       int64_t owner) {
+    byte_index_t j;
+
+    for (j = check->next; j < range->left; j++) {
+        check->ok = check->ok && check->owner[j] == -1;
+    }
+    for (j = range->left; j <= range->right; j++) {
+        check->ok = check->ok && check->owner[j] == owner;
+    }
+    check->ok = check->ok && range->left >= check->next &&
+        range->right <= check->end &&
+        (range->left == check->start ||
+         check->owner[range->left - 1] != owner) &&
+        (range->right == check->end || check->owner[range->right + 1] != owner);
+    check->next = range->right + 1;
+    check->visits++;
+    return check->visits != check->limit;
+}
+
+bool check_payload_fig(struct interval* range, struct check_payload* value,
+                       void* arg) {
+    struct typed_check* check = arg;
+    check->ok = check->ok && value->flags == (uint32_t) (value->id * 3) &&
+        value->gen == (uint32_t) ~value->id;
+    return check_typed_range(check, range, (int64_t) value->id);
+}
+
+bool check_double_fig(struct interval* range, double* value, void* arg) {
+    return check_typed_range(arg, range, (int64_t) (*value - 0.5));
+}
+
+/* Checks that the bytes after the last visited FIG are unmapped. */
+bool check_typed_end(struct typed_check* check) {
+    byte_index_t j;
+    for (j = check->next; j <= check->end; j++) {
+        check->ok = check->ok && check->owner[j] == -1;
+    }
+    return check->ok;
+}
+
+/* Checks the typed trees of typedtrees.h, one with a struct and one with a
+ * double as its values, through the same writes and erases, against a
+ * reference of which write last mapped each byte. */
+void test_typed(unsigned int seed) {
+    struct payloadtree payloads;
+    struct doubletree doubles;
+    struct payloadtree_iter* iter;
+    struct payloadtree_fig fig;
+    struct check_payload payload;
+    struct check_payload* foundpayload;
+    struct typed_check check;
+    int64_t owner[MAX_FILE_SIZE];
+    byte_index_t start, end, j;
+    double value;
+    double* founddouble;
+    int i;
+
+    payloadtree_init(&payloads);
+    doubletree_init(&doubles);
+    for (j = 0; j < MAX_FILE_SIZE; j++) {
+        owner[j] = -1;
+    }
+    for (i = 0; i < CHECK_WRITES; i++) {
+        random_range(&seed, &start, &end);
+        end = start + (end - start) / 8;
+        if ((rand_r(&seed) & 0x3) == 0) {
+            payloadtree_erase(&payloads, start, end);
+            doubletree_erase(&doubles, start, end);
+            for (j = start; j <= end; j++) {
+                owner[j] = -1;
+            }
+        } else {
+            payload.id = (uint64_t) i;
+            payload.flags = (uint32_t) (i * 3);
+            payload.gen = (uint32_t) ~payload.id;
+            value = i + 0.5;
+            payloadtree_write(&payloads, start, end, &payload);
+            doubletree_write(&doubles, start, end, &value);
+            for (j = start; j <= end; j++) {
+                owner[j] = i;
+            }
+        }
+        if (i % CHECK_CHUNKS != CHECK_CHUNKS - 1) {
+            continue;
+        }
+
+        for (j = 0; j < MAX_FILE_SIZE; j++) {
+            foundpayload = payloadtree_lookup(&payloads, j);
+            founddouble = doubletree_lookup(&doubles, j);
+            if ((foundpayload == NULL ? -1 : (int64_t) foundpayload->id) !=
+                owner[j] ||
+                (founddouble == NULL ? -1 : (int64_t) (*founddouble - 0.5)) !=
+                owner[j]) {
+                fprintf(stderr, "[ERROR] typed: lookup of byte %lu is "
+                        "wrong\n", (long unsigned int) j);
+                break;
+            }
+        }
+
+        /* A full range, a random range, and a traversal stopped early. */
+        memset(&check, 0x00, sizeof(check));
+        check.owner = owner;
+        check.end = MAX_FILE_SIZE - 1;
+        check.ok = true;
+        payloadtree_foreach(&payloads, 0, MAX_FILE_SIZE - 1,
+                            check_payload_fig, &check);
+        check.next = 0;
+        doubletree_foreach(&doubles, 0, MAX_FILE_SIZE - 1, check_double_fig,
+                           &check);
+        check_typed_end(&check);
+        random_range(&seed, &check.start, &check.end);
+        check.next = check.start;
+        payloadtree_foreach(&payloads, check.start, check.end,
+                            check_payload_fig, &check);
+        check.next = check.start;
+        doubletree_foreach(&doubles, check.start, check.end, check_double_fig,
+                           &check);
+        check_typed_end(&check);
+        check.next = check.start;
+        iter = payloadtree_read(&payloads, check.start, check.end);
+        while (payloadtree_next(iter, &fig)) {
+            check_payload_fig(&fig.irange, &fig.value, &check);
+        }
+        payloadtree_iter_free(iter);
+        check_typed_end(&check);
+        check.start = 0;
+        check.end = MAX_FILE_SIZE - 1;
+        check.next = 0;
+        check.visits = 0;
+        check.limit = 2;
+        check.ok = check.ok &&
+            (payloadtree_foreach(&payloads, 0, MAX_FILE_SIZE - 1,
+                                 check_payload_fig, &check) ==
+             (check.visits < 2));
+        if (!check.ok) {
+            fprintf(stderr, "[ERROR] typed: a traversal is wrong\n");
+        }
+
+        /* Later writes unpack the leaves they touch again. */
+        if ((rand_r(&seed) & 0x1) == 0) {
+            payloadtree_compress_leaves(&payloads);
+            doubletree_compress_leaves(&doubles);
+        }
+    }
+    payloadtree_dealloc(&payloads);
+    doubletree_dealloc(&doubles);
+}
+
+/* Checks that lookups through the lookup cache match FILE as the tree is
+ * written, shifted, erased and buffered, that the cache is used, and that a
+ * tree reinitialized at the same address never hits FIGs cached from the old
+ * one. */
+void test_lookup_cache(unsigned int seed) {
+    figtree_t ft;
+    figtree_value_t file[MAX_FILE_SIZE];
+    figtree_value_t* res;
+    uint64_t hits, misses, oldhits, oldmisses, lookups = 0;
+    byte_index_t start, end, j;
+    int64_t delta;
+    int i, k;
+
+    ft_lookup_cache_counts(&oldhits, &oldmisses);
+    init_file(&ft, file);
+    random_writes(&ft, file, &seed, CHECK_WRITES);
+    ft_set_lookup_cache(&ft, true);
+    for (i = 0; i < CHECK_WRITES; i++) {
+        random_range(&seed, &start, &end);
+        end = start + (end - start) / 8;
+        switch (rand_r(&seed) & 0x3) {
+        case 0:
+            random_writes(&ft, file, &seed, 1);
+            break;
+        case 1:
+            delta = (int64_t) (rand_r(&seed) & 0x7) - 4;
+            if (-delta > (int64_t) start) {
+                delta = -(int64_t) start;
+            }
+            ft_shift(&ft, start, delta);
+            ft_erase(&ft, MAX_FILE_SIZE, BYTE_INDEX_MAX);
+            shift_file(file, start, delta);
+            break;
+        case 2:
+            ft_erase(&ft, start, end);
+            for (j = start; j <= end; j++) {
+                file[j] = MAGIC;
+            }
+            break;
+        default:
+            /* Lookups must see buffered writes, and hit again once the
+             * buffer is flushed. */
+            if (i > CHECK_WRITES / 2 && ft.buffer == NULL) {
+                ft_set_write_buffer(&ft, CHECK_CHUNKS);
+            }
+            break;
+        }
+
+        /* Look up around one spot, as the cache is meant for. */
+        for (k = 0; k < CHECK_CHUNKS; k++) {
+            j = (start + (byte_index_t) k) & BYTE_INDEX_MASK;
+            res = ft_lookup(&ft, j);
+            lookups++;
+            if ((res == NULL ? (figtree_value_t) MAGIC : *res) != file[j]) {
+                fprintf(stderr, "[ERROR] lookup cache: lookup of byte %lu is "
+                        "wrong\n", (long unsigned int) j);
+                break;
+            }
+        }
+    }
+    ft_lookup_cache_counts(&hits, &misses);
+    hits -= oldhits;
+    misses -= oldmisses;
+    if (hits == 0 || misses == 0 || hits + misses != lookups) {
+        fprintf(stderr, "[ERROR] lookup cache: %lu hits and %lu misses in %lu "
+                "lookups\n", (long unsigned int) hits,
+                (long unsigned int) misses, (long unsigned int) lookups);
+    }
+    ft_dealloc(&ft);
+
+    /* The same address and epoch, but a new generation. */
+    ft_init(&ft);
+    ft_set_lookup_cache(&ft, true);
+    ft_write(&ft, 0, 9, 1);
+    ft_write(&ft, 20, 29, 5);
+    ft_lookup(&ft, 5);
+    ft_dealloc(&ft);
+    ft_init(&ft);
+    ft_set_lookup_cache(&ft, true);
+    ft_write(&ft, 0, 4, 3);
+    ft_write(&ft, 5, 9, 2);
+    res = ft_lookup(&ft, 5);
+    if (res == NULL || *res != 2) {
+        fprintf(stderr, "[ERROR] lookup cache: hit a FIG from a freed tree\n");
+    }
+
+    /* A conditional write that fails leaves the tree, and the cache, as it
+     * was. */
+    ft_lookup_cache_counts(&oldhits, &oldmisses);
+    if (ft_write_if(&ft, 0, 9, 4, 6, NULL, NULL)) {
+        fprintf(stderr, "[ERROR] lookup cache: ft_write_if wrote\n");
+    }
+    res = ft_lookup(&ft, 5);
+    ft_lookup_cache_counts(&hits, &misses);
+    if (res == NULL || *res != 2 || hits != oldhits + 1) {
+        fprintf(stderr, "[ERROR] lookup cache: a failed ft_write_if dropped "
+                "the cached FIGs\n");
+    }
+    ft_dealloc(&ft);
+}
+
+#define CHECK_ERASE_BLOCK 10
+
+/* Checks that erasing most of a large tree, one range at a time, frees most
+ * of its nodes and leaves only the FIGs outside of the erased ranges. */
+void test_erase(unsigned int seed) {
+    figtree_t ft;
+    struct ft_stats full, erased;
+    struct fig* figs;
+    figiter_t* figiter;
+    fig_t fig;
+    size_t i;
+    bool ok = true;
+
+    figs = malloc(CHECK_LOAD_FIGS * sizeof(struct fig));
+    for (i = 0; i < CHECK_LOAD_FIGS; i++) {
+        i_init(&figs[i].irange, (byte_index_t) (i << 2),
+               (byte_index_t) ((i << 2) + 2));
+        figs[i].value = (figtree_value_t) rand_r(&seed);
+    }
+    ft_load(&ft, figs, CHECK_LOAD_FIGS);
+    ft_stats(&ft, &full);
+
+    /* Keep only the last FIG of each block. */
+    for (i = 0; i + CHECK_ERASE_BLOCK <= CHECK_LOAD_FIGS;
+         i += CHECK_ERASE_BLOCK) {
+        ft_erase(&ft, (byte_index_t) (i << 2),
+                 (byte_index_t) ((i + CHECK_ERASE_BLOCK - 1) << 2) - 1);
+    }
+    ft_stats(&ft, &erased);
+    if (erased.height > full.height || erased.nodes > full.nodes / 4 ||
+        erased.entries != CHECK_LOAD_FIGS / CHECK_ERASE_BLOCK) {
+        fprintf(stderr, "[ERROR] erase: the tree did not shrink (%lu of %lu "
+                "nodes)\n", (long unsigned int) erased.nodes,
+                (long unsigned int) full.nodes);
+    }
+
+    figiter = ft_read(&ft, 0, BYTE_INDEX_MAX);
+    for (i = CHECK_ERASE_BLOCK - 1; ok && i < CHECK_LOAD_FIGS;
+         i += CHECK_ERASE_BLOCK) {
+        ok = fti_next(figiter, &fig) && same_fig(&fig, &figs[i]);
+    }
+    ok = ok && !fti_next(figiter, &fig);
+    fti_free(figiter);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] erase: the wrong FIGs are left\n");
+    }
+    free(figs);
+    ft_dealloc(&ft);
+}
+
 struct test_args {
     unsigned int seed;
     int threadid;
@@ -133,11 +1903,13 @@ struct test_args {
 void* test_start(void* _args) {
     struct test_args* args = _args;
     unsigned int seed = args->seed;
+    unsigned int editseed = args->seed;
     int threadid = args->threadid;
     long unsigned int i = 1;
     while (true) {
         printf("THREAD %d: ROUND %lu [seed = %u]\n", threadid, i, seed);
         seed = test_figtree(seed, threadid);
+        editseed = test_edits(editseed, threadid);
         i++;
     }
     return NULL;
@@ -161,6 +1933,31 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    printf("Checking features...\n");
+    test_frozen(1);
+    test_overlay(2);
+    test_diff(3);
+    test_write_exchange(4);
+    test_write_if(5);
+    test_counts(6);
+    test_value_index(7);
+    test_next_batch(8);
+    test_seek(9);
+    test_reverse(10);
+    test_foreach(11);
+    test_split(12);
+    test_load_parallel(13);
+    test_async(14);
+    test_write_buffer(15);
+    test_stats(16);
+    test_profile();
+    test_trace(17);
+    test_erase(18);
+    test_small(19);
+    test_compressed(20);
+    test_typed(21);
+    test_lookup_cache(22);
+
     for (c = 1; c <= numthreads; c++) {
         targs[c - 1].seed = (unsigned int) strtol(argv[c], NULL, 10);
         targs[c - 1].threadid = c;
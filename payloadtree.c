@@ -0,0 +1,7 @@
+#define FT_TYPED_NAME payloadtree
+#define FT_TYPED_VALUE struct check_payload
+#define FT_TYPED_EQUAL(a, b)                                                  \
+    ((a).id == (b).id && (a).flags == (b).flags && (a).gen == (b).gen)
+
+#include "typedtrees.h"
+#include "figtreetyped.c"
@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "figtree.h"
+#include "figtreebuf.h"
+#include "figtreetrace.h"
+#include "interval.h"
+
+/* Replays a trace recorded with ft_set_trace against a fresh Fig Tree, and
+ * reports throughput, latency percentiles per operation, and the shape of
+ * the final tree.
+ *
+ * Operations are handed out to the threads in trace order. Writes, shifts and
+ * erases are applied in trace order under an exclusive lock, while lookups
+ * and reads share the lock. With -c, lookups go through the lookup cache (see
+ * ft_set_lookup_cache). With -v, every update is also applied to a reference
+ * map; with one thread, each lookup and read is checked against it, and with
+ * more, only the final contents of the tree are.
+ */
+
+struct replay {
+    struct ftr_record* records;
+    size_t num_records;
+    size_t* writeord; // number of updates before each record
+    uint64_t* latency; // per record, in nanoseconds
+    struct figtree tree;
+    pthread_rwlock_t lock;
+    size_t next; // next record to hand out
+    size_t writes_done;
+    bool paced;
+    uint64_t started;
+    struct ft_buffer* reference; // NULL unless verifying every operation
+    size_t mismatches;
+    uint64_t cache_hits; // summed over the threads as they finish
+    uint64_t cache_misses;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t when) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (when / 1000000000);
+    ts.tv_nsec = (long) (when % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+}
+
+/* A growable array of FIGs. */
+struct figlist {
+    struct fig* figs;
+    size_t len;
+    size_t cap;
+};
+
+static void figlist_push(struct figlist* this, byte_index_t left,
+                         byte_index_t right, figtree_value_t value) {
+    if (this->len == this->cap) {
+        this->cap = this->cap == 0 ? 16 : (this->cap << 1);
+        this->figs = realloc(this->figs, this->cap * sizeof(struct fig));
+    }
+    i_init(&this->figs[this->len].irange, left, right);
+    this->figs[this->len].value = value;
+    this->len++;
+}
+
+/* Returns whether the tree and the reference map hold the same values over
+ * [START, END]. The two may split runs of bytes into FIGs differently.
+ */
+static bool check_range(struct figtree* tree, struct ft_buffer* reference,
+                        byte_index_t start, byte_index_t end) {
+    struct figlist a, b;
+    struct figtree_iter* iter;
+    struct fig fig;
+    size_t i, j;
+    bool same = true;
+
+    memset(&a, 0x00, sizeof(a));
+    memset(&b, 0x00, sizeof(b));
+    iter = ft_read(tree, start, end);
+    while (fti_next(iter, &fig)) {
+        figlist_push(&a, fig.irange.left, fig.irange.right, fig.value);
+    }
+    fti_free(iter);
+    for (i = ftb_find(reference, start);
+         i < reference->len && reference->ents[i].irange.left <= end; i++) {
+        figlist_push(&b, MAX(reference->ents[i].irange.left, start),
+                     MIN(reference->ents[i].irange.right, end),
+                     reference->ents[i].value);
+    }
+
+    i = 0;
+    j = 0;
+    while (same && i < a.len && j < b.len) {
+        struct interval* x = &a.figs[i].irange;
+        struct interval* y = &b.figs[j].irange;
+        byte_index_t right = MIN(x->right, y->right);
+        if (x->left != y->left || a.figs[i].value != b.figs[j].value) {
+            same = false;
+            break;
+        }
+        if (x->right == right) {
+            i++;
+        } else {
+            x->left = right + 1;
+        }
+        if (y->right == right) {
+            j++;
+        } else {
+            y->left = right + 1;
+        }
+    }
+    same = same && i == a.len && j == b.len;
+    free(a.figs);
+    free(b.figs);
+    return same;
+}
+
+/* Returns whether RECORD modifies the tree. */
+static bool is_update(struct ftr_record* record) {
+    return record->op == FTR_WRITE || record->op == FTR_SHIFT ||
+           record->op == FTR_ERASE;
+}
+
+/* Applies the update in RECORD to the reference map. */
+static void update_reference(struct ft_buffer* reference,
+                             struct ftr_record* record) {
+    if (record->op == FTR_WRITE) {
+        ftb_write(reference, record->start, record->end, record->value);
+    } else if (record->op == FTR_ERASE) {
+        ftb_erase(reference, record->start, record->end);
+    } else {
+        ftb_shift(reference, record->start, (int64_t) record->value);
+    }
+}
+
+static void replay_one(struct replay* this, size_t i) {
+    struct ftr_record* record = &this->records[i];
+    struct figtree_iter* iter;
+    struct fig fig;
+    figtree_value_t* found;
+    struct ft_ent* expected;
+    uint64_t start;
+
+    if (is_update(record)) {
+        /* Wait for the updates before this one to be applied. */
+        while (__atomic_load_n(&this->writes_done, __ATOMIC_ACQUIRE) !=
+               this->writeord[i]) {
+            sched_yield();
+        }
+        pthread_rwlock_wrlock(&this->lock);
+        start = now_ns();
+        if (record->op == FTR_WRITE) {
+            ft_write(&this->tree, record->start, record->end, record->value);
+        } else if (record->op == FTR_ERASE) {
+            ft_erase(&this->tree, record->start, record->end);
+        } else {
+            ft_shift(&this->tree, record->start, (int64_t) record->value);
+        }
+        this->latency[i] = now_ns() - start;
+        if (this->reference != NULL) {
+            update_reference(this->reference, record);
+        }
+        pthread_rwlock_unlock(&this->lock);
+        __atomic_store_n(&this->writes_done, this->writeord[i] + 1,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&this->lock);
+    if (record->op == FTR_LOOKUP) {
+        start = now_ns();
+        found = ft_lookup(&this->tree, record->start);
+        this->latency[i] = now_ns() - start;
+        if (this->reference != NULL) {
+            expected = ftb_lookup(this->reference, record->start);
+            if ((found == NULL) != (expected == NULL) ||
+                (found != NULL && *found != expected->value)) {
+                this->mismatches++;
+            }
+        }
+    } else {
+        start = now_ns();
+        iter = ft_read(&this->tree, record->start, record->end);
+        while (fti_next(iter, &fig)) {
+        }
+        fti_free(iter);
+        this->latency[i] = now_ns() - start;
+        if (this->reference != NULL &&
+            !check_range(&this->tree, this->reference, record->start,
+                         record->end)) {
+            this->mismatches++;
+        }
+    }
+    pthread_rwlock_unlock(&this->lock);
+}
+
+static void* replay_run(void* arg) {
+    struct replay* this = arg;
+    uint64_t hits, misses;
+    size_t i;
+    while ((i = __atomic_fetch_add(&this->next, 1, __ATOMIC_RELAXED)) <
+           this->num_records) {
+        if (this->paced) {
+            sleep_until(this->started + this->records[i].time);
+        }
+        replay_one(this, i);
+    }
+    ft_lookup_cache_counts(&hits, &misses);
+    __atomic_add_fetch(&this->cache_hits, hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->cache_misses, misses, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void report_op(struct replay* this, enum ftr_op op, const char* name) {
+    uint64_t* samples = malloc((this->num_records + 1) * sizeof(uint64_t));
+    size_t n = 0, i;
+    for (i = 0; i < this->num_records; i++) {
+        if (this->records[i].op == op) {
+            samples[n++] = this->latency[i];
+        }
+    }
+    if (n != 0) {
+        qsort(samples, n, sizeof(uint64_t), compare_u64);
+        printf("%-8s %10lu %10lu %10lu %10lu %10lu\n", name, (unsigned long) n,
+               (unsigned long) samples[n / 2],
+               (unsigned long) samples[n * 99 / 100],
+               (unsigned long) samples[n * 999 / 1000],
+               (unsigned long) samples[n - 1]);
+    }
+    free(samples);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-t threads] [-p] [-c] [-v] <trace>\n"
+            "  -t  number of threads to replay on (default 1)\n"
+            "  -p  replay at the recorded pace instead of at full speed\n"
+            "  -c  enable the lookup cache\n"
+            "  -v  verify results against a reference map\n", name);
+}
+
+int main(int argc, char** argv) {
+    struct replay replay;
+    struct ft_buffer reference;
+    struct ft_stats stats;
+    struct ftr_record record;
+    pthread_t* threads;
+    size_t cap = 1024, writes = 0, i;
+    int num_threads = 1, opt, t;
+    bool verify = false, lookup_cache = false;
+    uint64_t elapsed;
+    FILE* in;
+
+    memset(&replay, 0x00, sizeof(replay));
+    while ((opt = getopt(argc, argv, "t:pcv")) != -1) {
+        switch (opt) {
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'p':
+            replay.paced = true;
+            break;
+        case 'c':
+            lookup_cache = true;
+            break;
+        case 'v':
+            verify = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || num_threads < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    in = fopen(argv[optind], "rb");
+    if (in == NULL || !ftr_read_header(in)) {
+        fprintf(stderr, "%s is not a Fig Tree trace\n", argv[optind]);
+        return 1;
+    }
+    replay.records = malloc(cap * sizeof(struct ftr_record));
+    replay.writeord = malloc(cap * sizeof(size_t));
+    while (ftr_read_record(in, &record)) {
+        if (replay.num_records == cap) {
+            cap <<= 1;
+            replay.records = realloc(replay.records,
+                                     cap * sizeof(struct ftr_record));
+            replay.writeord = realloc(replay.writeord, cap * sizeof(size_t));
+        }
+        replay.writeord[replay.num_records] = writes;
+        replay.records[replay.num_records++] = record;
+        writes += is_update(&record);
+    }
+    fclose(in);
+    replay.latency = calloc(replay.num_records + 1, sizeof(uint64_t));
+
+    ft_init(&replay.tree);
+    ft_set_lookup_cache(&replay.tree, lookup_cache);
+    pthread_rwlock_init(&replay.lock, NULL);
+    ftb_init(&reference);
+    if (verify && num_threads == 1) {
+        replay.reference = &reference;
+    }
+
+    threads = malloc(num_threads * sizeof(pthread_t));
+    replay.started = now_ns();
+    for (t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t], NULL, replay_run, &replay);
+    }
+    for (t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    elapsed = now_ns() - replay.started;
+
+    printf("replayed %lu operations on %d threads in %.3f s: %.0f ops/sec\n",
+           (unsigned long) replay.num_records, num_threads,
+           (double) elapsed / 1e9,
+           (double) replay.num_records * 1e9 /
+           (double) (elapsed == 0 ? 1 : elapsed));
+    printf("%-8s %10s %10s %10s %10s %10s\n", "op", "count", "p50_ns",
+           "p99_ns", "p999_ns", "max_ns");
+    report_op(&replay, FTR_WRITE, "write");
+    report_op(&replay, FTR_SHIFT, "shift");
+    report_op(&replay, FTR_ERASE, "erase");
+    report_op(&replay, FTR_LOOKUP, "lookup");
+    report_op(&replay, FTR_READ, "read");
+
+    if (lookup_cache) {
+        printf("lookup cache: %lu hits, %lu misses, %.1f%% hit rate\n",
+               (unsigned long) replay.cache_hits,
+               (unsigned long) replay.cache_misses,
+               100.0 * (double) replay.cache_hits /
+               (double) (replay.cache_hits + replay.cache_misses == 0 ? 1 :
+                         replay.cache_hits + replay.cache_misses));
+    }
+
+    ft_stats(&replay.tree, &stats);
+    printf("final tree: height %d, %lu nodes, %lu entries, fill %.2f, "
+           "%lu bytes mapped, %lu bytes allocated\n", stats.height,
+           (unsigned long) stats.nodes, (unsigned long) stats.entries,
+           stats.fill_factor, (unsigned long) stats.mapped_bytes,
+           (unsigned long) stats.allocated_bytes);
+
+    if (verify) {
+        if (replay.reference == NULL) {
+            for (i = 0; i < replay.num_records; i++) {
+                if (is_update(&replay.records[i])) {
+                    update_reference(&reference, &replay.records[i]);
+                }
+            }
+        }
+        if (!check_range(&replay.tree, &reference, BYTE_INDEX_MIN,
+                         BYTE_INDEX_MAX)) {
+            replay.mismatches++;
+        }
+        printf("verify: %lu mismatches\n", (unsigned long) replay.mismatches);
+    }
+
+    ftb_dealloc(&reference);
+    ft_dealloc(&replay.tree);
+    pthread_rwlock_destroy(&replay.lock);
+    free(threads);
+    free(replay.latency);
+    free(replay.writeord);
+    free(replay.records);
+    return replay.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#ifndef _TYPEDTREES_H_
+#define _TYPEDTREES_H_
+
+#include <stdint.h>
+
+#include "figtreetyped.h"
+
+/* The typed trees that test_typed in main.c checks, instantiated in
+ * payloadtree.c and doubletree.c. */
+
+struct check_payload {
+    uint64_t id;
+    uint32_t flags;
+    uint32_t gen;
+};
+
+FIGTREE_DECLARE(payloadtree, struct check_payload);
+FIGTREE_DECLARE(doubletree, double);
+
+#endif
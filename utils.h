@@ -5,9 +5,20 @@
 #include <stdint.h>
 
 typedef uint32_t byte_index_t;
+/* figtreetyped.c overrides these to build a tree over another value type */
+#ifdef FT_VALUE_TYPE
+typedef FT_VALUE_TYPE figtree_value_t;
+#else
 typedef long int figtree_value_t;
+#endif
+
+#ifndef FT_VALUE_EQUAL
+#define FT_VALUE_EQUAL(a, b) ((a) == (b))
+#endif
 
+#ifndef FT_ORDER
 #define FT_ORDER 2
+#endif
 #define FT_SPLITLIMIT (1 + (FT_ORDER << 1))
 
 struct subtree_ptr {